@@ -0,0 +1,261 @@
+#include "DbAggregateTable.h"
+
+#include <QDebug>
+#include <QSet>
+
+namespace PortableDBBackend
+{
+	DbAggregateTableDefinition::DbAggregateTableDefinition(const QString& AggregateTable, const QString& SourceTable, const QStringList& GroupColumns,
+		const QList<DbAggregateColumn>& Aggregates, int IntroducedInVersion, int RebuildVersion)
+		: m_AggregateTable(AggregateTable)
+		, m_SourceTable(SourceTable)
+		, m_GroupColumns(GroupColumns)
+		, m_Aggregates(Aggregates)
+		, m_iIntroducedInVersion(IntroducedInVersion)
+		, m_iRebuildVersion(RebuildVersion)
+		, m_bValid(true)
+	{
+		// the generated rowcount column and every group and aggregate column share one table
+		QSet<QString> Names;
+		Names.insert("rowcount");
+		QStringList Columns = m_GroupColumns;
+		for (const DbAggregateColumn& Aggregate : m_Aggregates)
+		{
+			Columns.append(Aggregate.Name);
+		}
+		for (const QString& Column : Columns)
+		{
+			const QString Name = Column.trimmed().toLower();
+			if (Names.contains(Name))
+			{
+				qDebug() << "aggregate table " << m_AggregateTable << " ... rejected, duplicate column " << Column;
+				m_bValid = false;
+			}
+			Names.insert(Name);
+		}
+	}
+
+	bool DbAggregateTableDefinition::isValid() const
+	{
+		return m_bValid;
+	}
+
+	QString DbAggregateTableDefinition::aggregateTable() const
+	{
+		return m_AggregateTable;
+	}
+
+	QString DbAggregateTableDefinition::lookupSql() const
+	{
+		QStringList Conditions;
+		for (const QString& Column : m_GroupColumns)
+		{
+			Conditions.append(QString("%1 IS ?").arg(Column));
+		}
+		if (Conditions.isEmpty())
+			return selectAllSql();
+		return QString("SELECT * FROM %1 WHERE %2;").arg(m_AggregateTable, Conditions.join(" AND "));
+	}
+
+	QString DbAggregateTableDefinition::selectAllSql() const
+	{
+		return QString("SELECT * FROM %1;").arg(m_AggregateTable);
+	}
+
+	QStringList DbAggregateTableDefinition::getCreateStatements(int /*TargetVersion*/) const
+	{
+		QStringList CreateList;
+		if (!m_bValid)
+			return CreateList;
+		QStringList Columns = m_GroupColumns;
+		Columns.append("rowcount INTEGER NOT NULL DEFAULT 0");
+		for (const DbAggregateColumn& Aggregate : m_Aggregates)
+		{
+			Columns.append(QString("%1 %2 NOT NULL DEFAULT 0").arg(Aggregate.Name, Aggregate.Function == DbAggregateFunction::Sum ? "NUMERIC" : "INTEGER"));
+		}
+		CreateList.append(QString("CREATE TABLE %1 ( %2 );").arg(m_AggregateTable, Columns.join(", ")));
+		if (!m_GroupColumns.isEmpty())
+		{
+			// NULL groups aren't unique to the index, the triggers look groups up with IS and never insert twice
+			CreateList.append(QString("CREATE UNIQUE INDEX %1_groups ON %1 ( %2 );").arg(m_AggregateTable, m_GroupColumns.join(", ")));
+		}
+		CreateList.append(triggerStatements());
+		return CreateList;
+	}
+
+	QString DbAggregateTableDefinition::groupMatch(const QString& RowPrefix) const
+	{
+		QStringList Conditions;
+		for (const QString& Column : m_GroupColumns)
+		{
+			Conditions.append(QString("%1 IS %2%1").arg(Column, RowPrefix));
+		}
+		return Conditions.join(" AND ");
+	}
+
+	QString DbAggregateTableDefinition::whereGroup(const QString& RowPrefix) const
+	{
+		return m_GroupColumns.isEmpty() ? QString() : QString(" WHERE ") + groupMatch(RowPrefix);
+	}
+
+	QString DbAggregateTableDefinition::deltaList(const QString& RowPrefix, const QString& Sign) const
+	{
+		QStringList Assignments;
+		Assignments.append(QString("rowcount = rowcount %1 1").arg(Sign));
+		for (const DbAggregateColumn& Aggregate : m_Aggregates)
+		{
+			QString sDelta;
+			if (Aggregate.Function == DbAggregateFunction::Sum)
+				sDelta = QString("coalesce(%1%2, 0)").arg(RowPrefix, Aggregate.SourceColumn);
+			else if (Aggregate.SourceColumn.isEmpty())
+				sDelta = "1";
+			else
+				sDelta = QString("(%1%2 IS NOT NULL)").arg(RowPrefix, Aggregate.SourceColumn);
+			Assignments.append(QString("%1 = %1 %2 %3").arg(Aggregate.Name, Sign, sDelta));
+		}
+		return Assignments.join(", ");
+	}
+
+	QString DbAggregateTableDefinition::addRowSql(const QString& RowPrefix) const
+	{
+		QString sInsertGroup;
+		if (m_GroupColumns.isEmpty())
+		{
+			sInsertGroup = QString("INSERT INTO %1 (rowcount) SELECT 0 WHERE NOT EXISTS (SELECT 1 FROM %1);").arg(m_AggregateTable);
+		}
+		else
+		{
+			QStringList Values;
+			for (const QString& Column : m_GroupColumns)
+			{
+				Values.append(RowPrefix + Column);
+			}
+			sInsertGroup = QString("INSERT INTO %1 (%2) SELECT %3 WHERE NOT EXISTS (SELECT 1 FROM %1 WHERE %4);")
+				.arg(m_AggregateTable, m_GroupColumns.join(", "), Values.join(", "), groupMatch(RowPrefix));
+		}
+		const QString sUpdate = QString("UPDATE %1 SET %2%3;").arg(m_AggregateTable, deltaList(RowPrefix, "+"), whereGroup(RowPrefix));
+		return sInsertGroup + " " + sUpdate;
+	}
+
+	QString DbAggregateTableDefinition::removeRowSql(const QString& RowPrefix) const
+	{
+		QString sRemove = QString("UPDATE %1 SET %2%3;").arg(m_AggregateTable, deltaList(RowPrefix, "-"), whereGroup(RowPrefix));
+		if (!m_GroupColumns.isEmpty())
+		{
+			// empty groups disappear, as they would from a GROUP BY; the totals row always stays
+			sRemove += QString(" DELETE FROM %1 WHERE %2 AND rowcount <= 0;").arg(m_AggregateTable, groupMatch(RowPrefix));
+		}
+		return sRemove;
+	}
+
+	QStringList DbAggregateTableDefinition::sourceColumns() const
+	{
+		QStringList Columns = m_GroupColumns;
+		for (const DbAggregateColumn& Aggregate : m_Aggregates)
+		{
+			if (!Aggregate.SourceColumn.isEmpty() && !Columns.contains(Aggregate.SourceColumn))
+			{
+				Columns.append(Aggregate.SourceColumn);
+			}
+		}
+		return Columns;
+	}
+
+	QStringList DbAggregateTableDefinition::triggerStatements() const
+	{
+		QStringList Triggers;
+		Triggers.append(QString("CREATE TRIGGER %1_ai AFTER INSERT ON %2 BEGIN %3 END;")
+			.arg(m_AggregateTable, m_SourceTable, addRowSql("new.")));
+		Triggers.append(QString("CREATE TRIGGER %1_ad AFTER DELETE ON %2 BEGIN %3 END;")
+			.arg(m_AggregateTable, m_SourceTable, removeRowSql("old.")));
+
+		// only updates changing a group or an aggregated value cost aggregate work
+		const QStringList Columns = sourceColumns();
+		if (!Columns.isEmpty())
+		{
+			QStringList Changes;
+			for (const QString& Column : Columns)
+			{
+				Changes.append(QString("old.%1 IS NOT new.%1").arg(Column));
+			}
+			Triggers.append(QString("CREATE TRIGGER %1_au AFTER UPDATE OF %2 ON %3 WHEN %4 BEGIN %5 %6 END;")
+				.arg(m_AggregateTable, Columns.join(", "), m_SourceTable, Changes.join(" OR "), removeRowSql("old."), addRowSql("new.")));
+		}
+		return Triggers;
+	}
+
+	QStringList DbAggregateTableDefinition::rebuildStatements() const
+	{
+		if (!m_bValid)
+			return QStringList();
+		QStringList Columns = m_GroupColumns;
+		QStringList Values = m_GroupColumns;
+		Columns.append("rowcount");
+		Values.append("COUNT(*)");
+		for (const DbAggregateColumn& Aggregate : m_Aggregates)
+		{
+			Columns.append(Aggregate.Name);
+			if (Aggregate.Function == DbAggregateFunction::Sum)
+				Values.append(QString("coalesce(SUM(%1), 0)").arg(Aggregate.SourceColumn));
+			else if (Aggregate.SourceColumn.isEmpty())
+				Values.append("COUNT(*)");
+			else
+				Values.append(QString("COUNT(%1)").arg(Aggregate.SourceColumn));
+		}
+
+		QString sInsert = QString("INSERT INTO %1 (%2) SELECT %3 FROM %4")
+			.arg(m_AggregateTable, Columns.join(", "), Values.join(", "), m_SourceTable);
+		// without GROUP BY the select returns the totals row even for an empty source
+		if (!m_GroupColumns.isEmpty())
+		{
+			sInsert += QString(" GROUP BY %1").arg(m_GroupColumns.join(", "));
+		}
+		sInsert += ";";
+
+		QStringList List;
+		List.append(QString("DELETE FROM %1;").arg(m_AggregateTable));
+		List.append(sInsert);
+		return List;
+	}
+
+	bool DbAggregateTableDefinition::NeedUpdate(int OldVersion, int UpdatedVersion) const
+	{
+		bool bRet = false;
+		if (OldVersion < m_iIntroducedInVersion && m_iIntroducedInVersion <= UpdatedVersion)
+			bRet = true;
+		if (m_iRebuildVersion > 0 && OldVersion < m_iRebuildVersion && m_iRebuildVersion <= UpdatedVersion)
+			bRet = true;
+		return bRet;
+	}
+
+	QStringList DbAggregateTableDefinition::getUpdateStatement(int /*OldVersion*/, int TargetVersion) const
+	{
+		// the aggregate is derived data: recreating it is cheaper to get right than migrating it,
+		// and it repairs triggers lost when an update of the source table recreated the table (see RebuildVersion)
+		QStringList sCmdLst;
+		if (!m_bValid)
+			return sCmdLst;
+		sCmdLst.append(QString("DROP TRIGGER IF EXISTS %1_ai;").arg(m_AggregateTable));
+		sCmdLst.append(QString("DROP TRIGGER IF EXISTS %1_ad;").arg(m_AggregateTable));
+		sCmdLst.append(QString("DROP TRIGGER IF EXISTS %1_au;").arg(m_AggregateTable));
+		sCmdLst.append(QString("DROP TABLE IF EXISTS %1;").arg(m_AggregateTable));
+		sCmdLst.append(getCreateStatements(TargetVersion));
+		sCmdLst.append(insertInitialRows(TargetVersion));
+		return sCmdLst;
+	}
+
+	QStringList DbAggregateTableDefinition::getDeleteStatements() const
+	{
+		QStringList List;
+		if (m_bValid)
+		{
+			List.append(QString("DELETE FROM %1;").arg(m_AggregateTable));
+		}
+		return List;
+	}
+
+	QStringList DbAggregateTableDefinition::insertInitialRows(int /*TargetVersion*/) const
+	{
+		return rebuildStatements();
+	}
+}
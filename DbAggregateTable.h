@@ -0,0 +1,84 @@
+#pragma once
+#include "databackend.h"
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+namespace PortableDBBackend
+{
+	//! @brief aggregates that can be maintained row by row, MIN/MAX can't be undone on delete and are therefore missing
+	//! averages are Sum divided by the row count of the group
+	enum class DbAggregateFunction
+	{
+		Count, //!< rows of the group, or rows with a non NULL SourceColumn
+		Sum //!< sum of SourceColumn, NULL values count as 0
+	};
+
+	//! @brief one aggregate column of a DbAggregateTableDefinition
+	struct DbAggregateColumn
+	{
+		QString Name; //!< column in the aggregate table
+		DbAggregateFunction Function;
+		QString SourceColumn; //!< column of the source table, may be empty for Count
+	};
+
+	//! @brief DbAggregateTableDefinition declares a materialized GROUP BY over an existing source table
+	//! the aggregate table holds one row per group (group columns, rowcount, aggregate columns) and is kept up to date
+	//! by triggers on the source table, so dashboards read a single row instead of scanning the source every time
+	//! a table without group columns holds exactly one row with the totals
+	//! add it after its source table, DeleteAllData rebuilds it afterwards through insertInitialRows
+	//! REPLACE on the source table only runs the delete trigger with PRAGMA recursive_triggers, which DataBackend turns on
+	class DbAggregateTableDefinition : public ITableDefinition
+	{
+	public:
+		//! @param AggregateTable name of the generated table
+		//! @param SourceTable table in the main database, partitions of DbTimePartitionedTable can't have triggers into it
+		//! @param GroupColumns columns of SourceTable to GROUP BY, empty for totals
+		//! @param Aggregates their names must differ from each other, from GroupColumns and from the generated "rowcount",
+		//! DbHandler::AddTable rejects a definition with clashing column names
+		//! @param IntroducedInVersion Db version that added the aggregate, older files get it created (and filled) by RunUpdates
+		//! @param RebuildVersion updating a file across this version recreates the aggregate from the source, e.g. after
+		//! changing its definition or an update of the source table that recreated it (dropping the triggers), 0 = never
+		DbAggregateTableDefinition(const QString& AggregateTable, const QString& SourceTable, const QStringList& GroupColumns,
+			const QList<DbAggregateColumn>& Aggregates, int IntroducedInVersion = 0, int RebuildVersion = 0);
+
+		virtual bool isValid() const override; //!< false for clashing column names, see the constructor
+		QString aggregateTable() const;
+
+		//! @brief single row lookup, binds one value per group column (NULL matches NULL)
+		//! result columns: group columns, rowcount, aggregate columns
+		QString lookupSql() const;
+		//! @brief all groups, e.g. for a chart, same result columns as lookupSql
+		QString selectAllSql() const;
+		//! @brief recomputes the aggregate table from the source table with one full scan
+		QStringList rebuildStatements() const;
+
+		// ITableDefinition
+		virtual QStringList getCreateStatements(int TargetVersion) const override;
+		//! true when crossing IntroducedInVersion or RebuildVersion
+		virtual bool NeedUpdate(int OldVersion, int UpdatedVersion) const override;
+		//! drops and recreates table and triggers from the current definition and rebuilds the content
+		virtual QStringList getUpdateStatement(int OldVersion, int TargetVersion) const override;
+		virtual QStringList getDeleteStatements() const override;
+		//! rebuilds from rows inserted before the triggers existed, for totals this inserts the single row
+		virtual QStringList insertInitialRows(int TargetVersion) const override;
+
+	private:
+		QString m_AggregateTable;
+		QString m_SourceTable;
+		QStringList m_GroupColumns;
+		QList<DbAggregateColumn> m_Aggregates;
+		int m_iIntroducedInVersion;
+		int m_iRebuildVersion;
+		bool m_bValid;
+
+		QStringList triggerStatements() const;
+		QStringList sourceColumns() const; //!< group and aggregated columns, a change of any of them moves a row between groups or changes its values
+		QString groupMatch(const QString& RowPrefix) const; //!< "g IS new.g AND ...", empty without group columns
+		QString whereGroup(const QString& RowPrefix) const;
+		QString addRowSql(const QString& RowPrefix) const;
+		QString removeRowSql(const QString& RowPrefix) const;
+		QString deltaList(const QString& RowPrefix, const QString& Sign) const; //!< SET list applying one source row
+	};
+}
@@ -0,0 +1,109 @@
+#include "DbCheckpointScheduler.h"
+
+#include <QFileInfo>
+#include <QSqlQuery>
+#include <QVariant>
+
+namespace PortableDBBackend
+{
+	void DbCheckpointScheduler::setSettings(const DbCheckpointSettings& Settings)
+	{
+		m_Settings = Settings;
+	}
+
+	const DbCheckpointSettings& DbCheckpointScheduler::settings() const
+	{
+		return m_Settings;
+	}
+
+	bool DbCheckpointScheduler::configure(QSqlDatabase& Db)
+	{
+		if (!Db.isOpen())
+			return false;
+
+		QSqlQuery Query(Db);
+		if (!m_Settings.bEnabled)
+		{
+			if (m_bWalConfigured)
+			{
+				// hand checkpointing back to SQLite (default threshold), the journal mode stays WAL
+				Query.exec("PRAGMA wal_autocheckpoint = 1000;");
+				m_bWalConfigured = false;
+			}
+			return true;
+		}
+
+		// journal_mode answers with the mode actually in use, e.g. "memory" for in-memory databases
+		if (!Query.exec("PRAGMA journal_mode = WAL;") || !Query.next()
+			|| Query.value(0).toString().compare("wal", Qt::CaseInsensitive) != 0)
+		{
+			return false;
+		}
+		if (!Query.exec("PRAGMA wal_autocheckpoint = 0;"))
+			return false;
+		m_bWalConfigured = true;
+		return true;
+	}
+
+	qint64 DbCheckpointScheduler::walSize(const QSqlDatabase& Db)
+	{
+		// a fresh QFileInfo, cached sizes are of no use here
+		QFileInfo WalFile(Db.databaseName() + "-wal");
+		return WalFile.exists() ? WalFile.size() : 0;
+	}
+
+	DbCheckpointMode DbCheckpointScheduler::modeForWalSize(qint64 WalBytes) const
+	{
+		if (m_Settings.WalTruncateLimit > 0 && WalBytes > m_Settings.WalTruncateLimit)
+			return DbCheckpointMode::Truncate;
+		if (m_Settings.WalSizeBudget > 0 && WalBytes > m_Settings.WalSizeBudget)
+			return DbCheckpointMode::Restart;
+		return DbCheckpointMode::Passive;
+	}
+
+	bool DbCheckpointScheduler::checkpointOverdue(const QSqlDatabase& Db) const
+	{
+		if (!m_bWalConfigured)
+			return false;
+		const qint64 WalBytes = walSize(Db);
+		if (m_Settings.WalTruncateLimit > 0 && WalBytes > m_Settings.WalTruncateLimit)
+			return true;
+		// rate limited, under constant load a restart per write batch would mostly wait for readers
+		return m_Settings.WalSizeBudget > 0 && WalBytes > m_Settings.WalSizeBudget
+			&& (!m_LastCheckpoint.isValid() || m_LastCheckpoint.hasExpired(m_Settings.BusyIntervalMilliseconds));
+	}
+
+	DbCheckpointStatistics DbCheckpointScheduler::checkpoint(QSqlDatabase& Db, DbCheckpointMode Mode)
+	{
+		DbCheckpointStatistics Statistics;
+		Statistics.Mode = Mode;
+		Statistics.WalBytesBefore = walSize(Db);
+
+		QString sMode;
+		switch (Mode)
+		{
+		case DbCheckpointMode::Passive: sMode = "PASSIVE"; break;
+		case DbCheckpointMode::Restart: sMode = "RESTART"; break;
+		case DbCheckpointMode::Truncate: sMode = "TRUNCATE"; break;
+		}
+
+		QElapsedTimer Timer;
+		Timer.start();
+		QSqlQuery Query(Db);
+		// returns one row: busy, frames in the WAL, frames checkpointed
+		if (Query.exec(QString("PRAGMA wal_checkpoint(%1);").arg(sMode)) && Query.next())
+		{
+			Statistics.bBusy = Query.value(0).toInt() != 0;
+			Statistics.LogFrames = Query.value(1).toInt();
+			Statistics.CheckpointedFrames = Query.value(2).toInt();
+		}
+		else
+		{
+			Statistics.bBusy = true;
+		}
+		Statistics.DurationMicroseconds = Timer.nsecsElapsed() / 1000;
+		m_LastCheckpoint.start();
+		Statistics.WalBytesAfter = walSize(Db);
+		return Statistics;
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QMetaType>
+#include <QSqlDatabase>
+#include <QString>
+
+namespace PortableDBBackend
+{
+	//! @brief WAL checkpoint modes, see PRAGMA wal_checkpoint
+	enum class DbCheckpointMode
+	{
+		Passive, //!< copy what isn't needed by readers, never waits
+		Restart, //!< waits for readers so the next writer starts at the beginning of the WAL
+		Truncate //!< like Restart and truncates the WAL file to zero bytes
+	};
+
+	//! @brief checkpoint control of the Db thread connection
+	struct DbCheckpointSettings
+	{
+		bool bEnabled = false; //!< switches the file to WAL and turns SQLite's automatic checkpoint off
+		int IdleMilliseconds = 250; //!< quiet time of the operation queue before a checkpoint runs
+		qint64 WalSizeBudget = 4 * 1024 * 1024; //!< above: Restart instead of Passive, while busy at most every BusyIntervalMilliseconds
+		qint64 WalTruncateLimit = 32 * 1024 * 1024; //!< above: Truncate, while busy as well
+		int BusyIntervalMilliseconds = 1000; //!< minimum time between checkpoints of a WAL above the budget while the queue never becomes idle
+	};
+
+	struct DbCheckpointStatistics
+	{
+		DbCheckpointMode Mode = DbCheckpointMode::Passive;
+		qint64 WalBytesBefore = 0;
+		qint64 WalBytesAfter = 0;
+		int LogFrames = 0; //!< frames in the WAL
+		int CheckpointedFrames = 0;
+		bool bBusy = false; //!< the checkpoint could not complete because of readers or writers
+		qint64 DurationMicroseconds = 0;
+	};
+
+	//! @brief DbCheckpointScheduler decides when and how to checkpoint, ThreadedDbHandler provides the idle timer
+	//! not thread safe, it lives on the Db thread like the connection it manages
+	class DbCheckpointScheduler
+	{
+	public:
+		void setSettings(const DbCheckpointSettings& Settings);
+		const DbCheckpointSettings& settings() const;
+
+		//! @brief applies journal mode and autocheckpoint to an open connection, false if WAL isn't available
+		bool configure(QSqlDatabase& Db);
+
+		//! @brief current size of the WAL file of Db
+		static qint64 walSize(const QSqlDatabase& Db);
+		//! @brief mode for the current WAL size
+		DbCheckpointMode modeForWalSize(qint64 WalBytes) const;
+		//! @brief true if the WAL exceeds the truncate limit, or the budget with the last checkpoint BusyIntervalMilliseconds ago,
+		//! and can't wait for the queue to become idle
+		bool checkpointOverdue(const QSqlDatabase& Db) const;
+
+		DbCheckpointStatistics checkpoint(QSqlDatabase& Db, DbCheckpointMode Mode);
+
+	private:
+		DbCheckpointSettings m_Settings;
+		bool m_bWalConfigured = false; //!< we switched off the autocheckpoint and have to restore it
+		QElapsedTimer m_LastCheckpoint; //!< invalid until the first checkpoint
+	};
+}
+
+Q_DECLARE_METATYPE(PortableDBBackend::DbCheckpointSettings);
+Q_DECLARE_METATYPE(PortableDBBackend::DbCheckpointStatistics);
@@ -0,0 +1,340 @@
+#include "DbColumnCodec.h"
+
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <atomic>
+
+namespace PortableDBBackend
+{
+	struct DbColumnCodecState
+	{
+		int iThreshold = 4096;
+		std::shared_ptr<const IDbColumnCodec> spCodec;
+
+		std::atomic<quint64> Encoded{ 0 };
+		std::atomic<quint64> Compressed{ 0 };
+		std::atomic<quint64> Decoded{ 0 };
+		std::atomic<qint64> BytesIn{ 0 };
+		std::atomic<qint64> BytesStored{ 0 };
+		std::atomic<qint64> EncodeNanoseconds{ 0 };
+		std::atomic<qint64> DecodeNanoseconds{ 0 };
+	};
+
+	namespace
+	{
+		// header: magic (3 bytes), codec id, flags, uncompressed size (uint32 big endian)
+		const char Magic[3] = { '\xC7', 'P', 'Z' };
+		const int HeaderSize = 9;
+		const quint8 StoredCodecId = 0; //!< payload isn't compressed, only used for blobs that start with the magic
+		const quint8 TextFlag = 0x01;
+
+		bool hasHeader(const QByteArray& Stored)
+		{
+			return Stored.size() >= HeaderSize && Stored[0] == Magic[0] && Stored[1] == Magic[1] && Stored[2] == Magic[2];
+		}
+
+		QByteArray frame(quint8 CodecId, quint8 Flags, int UncompressedSize, const QByteArray& Payload)
+		{
+			QByteArray Stored;
+			Stored.reserve(HeaderSize + Payload.size());
+			Stored.append(Magic, 3);
+			Stored.append(static_cast<char>(CodecId));
+			Stored.append(static_cast<char>(Flags));
+			const quint32 iSize = static_cast<quint32>(UncompressedSize);
+			Stored.append(static_cast<char>((iSize >> 24) & 0xFF));
+			Stored.append(static_cast<char>((iSize >> 16) & 0xFF));
+			Stored.append(static_cast<char>((iSize >> 8) & 0xFF));
+			Stored.append(static_cast<char>(iSize & 0xFF));
+			Stored.append(Payload);
+			return Stored;
+		}
+
+		//! @brief blobs below the threshold are stored as they are unless they could be mistaken for a header
+		QVariant storeUncompressed(const QVariant& Value, const QByteArray& Data, bool bText)
+		{
+			if (!bText && hasHeader(Data))
+				return frame(StoredCodecId, 0, Data.size(), Data);
+			return Value;
+		}
+
+		struct CodecRegistry
+		{
+			QReadWriteLock lCodecs;
+			std::map<quint8, std::shared_ptr<const IDbColumnCodec>> Codecs;
+
+			CodecRegistry()
+			{
+				auto spZlib = std::make_shared<DbZlibCodec>();
+				Codecs[spZlib->codecId()] = spZlib;
+			}
+		};
+
+		CodecRegistry& codecRegistry()
+		{
+			static CodecRegistry Registry;
+			return Registry;
+		}
+
+		std::shared_ptr<const IDbColumnCodec> findCodec(quint8 CodecId)
+		{
+			CodecRegistry& Registry = codecRegistry();
+			QReadLocker Lock(&Registry.lCodecs);
+			auto It = Registry.Codecs.find(CodecId);
+			return It != Registry.Codecs.end() ? It->second : nullptr;
+		}
+
+		//! @brief Stored must have a header, returns a null QVariant and sets Error for unknown codecs or corrupt data
+		QVariant decodeFramed(const QByteArray& Stored, DbColumnCodecState* pState, QString& Error)
+		{
+			const quint8 CodecId = static_cast<quint8>(Stored[3]);
+			const quint8 Flags = static_cast<quint8>(Stored[4]);
+			const int iUncompressedSize = static_cast<int>(
+				(static_cast<quint32>(static_cast<quint8>(Stored[5])) << 24) |
+				(static_cast<quint32>(static_cast<quint8>(Stored[6])) << 16) |
+				(static_cast<quint32>(static_cast<quint8>(Stored[7])) << 8) |
+				static_cast<quint32>(static_cast<quint8>(Stored[8])));
+			// the payload references Stored, the codec reads it without a copy
+			const QByteArray Payload = QByteArray::fromRawData(Stored.constData() + HeaderSize, Stored.size() - HeaderSize);
+
+			if (CodecId == StoredCodecId)
+			{
+				if (Payload.size() != iUncompressedSize)
+				{
+					Error = QString("truncated value, %1 of %2 bytes").arg(Payload.size()).arg(iUncompressedSize);
+					return QVariant();
+				}
+				return QByteArray(Payload.constData(), Payload.size());
+			}
+
+			auto spCodec = findCodec(CodecId);
+			if (!spCodec)
+			{
+				Error = QString("value compressed with unknown codec %1, see DbColumnCodec::registerCodec").arg(CodecId);
+				return QVariant();
+			}
+
+			QElapsedTimer Timer;
+			Timer.start();
+			QByteArray Data = spCodec->decompress(Payload, iUncompressedSize);
+			if (pState)
+			{
+				pState->Decoded++;
+				pState->DecodeNanoseconds += Timer.nsecsElapsed();
+			}
+			if (Data.size() != iUncompressedSize)
+			{
+				Error = QString("corrupt compressed value, %1 of %2 bytes decoded").arg(Data.size()).arg(iUncompressedSize);
+				return QVariant();
+			}
+			if (Flags & TextFlag)
+				return QString::fromUtf8(Data);
+			return Data;
+		}
+
+		QVariant decodeStored(const QVariant& Stored, DbColumnCodecState* pState, QString& Error)
+		{
+			// text columns come back as QString, compressed values are always blobs
+			if (Stored.userType() != QMetaType::QByteArray)
+				return Stored;
+			const QByteArray Data = Stored.toByteArray();
+			if (!hasHeader(Data))
+				return Stored;
+			return decodeFramed(Data, pState, Error);
+		}
+	}
+
+	DbZlibCodec::DbZlibCodec(int CompressionLevel)
+		: m_iCompressionLevel(CompressionLevel)
+	{
+	}
+
+	quint8 DbZlibCodec::codecId() const
+	{
+		return 1;
+	}
+
+	QByteArray DbZlibCodec::compress(const QByteArray& Data) const
+	{
+		return qCompress(Data, m_iCompressionLevel);
+	}
+
+	QByteArray DbZlibCodec::decompress(const QByteArray& Data, int /*UncompressedSize*/) const
+	{
+		// qCompress keeps its own size prefix, qUncompress validates it
+		return qUncompress(Data);
+	}
+
+	bool DbCompressedValue::isNull() const
+	{
+		return m_Stored.isNull();
+	}
+
+	bool DbCompressedValue::isCompressed() const
+	{
+		return m_Stored.userType() == QMetaType::QByteArray && DbColumnCodec::isCompressed(m_Stored.toByteArray());
+	}
+
+	int DbCompressedValue::storedSize() const
+	{
+		if (m_Stored.userType() == QMetaType::QString)
+			return m_Stored.toString().toUtf8().size();
+		return m_Stored.toByteArray().size();
+	}
+
+	bool DbCompressedValue::isCorrupt() const
+	{
+		decodeOnce();
+		return !m_Error.isEmpty();
+	}
+
+	QString DbCompressedValue::errorString() const
+	{
+		decodeOnce();
+		return m_Error;
+	}
+
+	QByteArray DbCompressedValue::bytes() const
+	{
+		decodeOnce();
+		if (m_Decoded.userType() == QMetaType::QString)
+			return m_Decoded.toString().toUtf8();
+		return m_Decoded.toByteArray();
+	}
+
+	QString DbCompressedValue::text() const
+	{
+		decodeOnce();
+		return m_Decoded.toString();
+	}
+
+	QVariant DbCompressedValue::value() const
+	{
+		decodeOnce();
+		return m_Decoded;
+	}
+
+	void DbCompressedValue::decodeOnce() const
+	{
+		if (m_bDecoded)
+			return;
+		m_Decoded = decodeStored(m_Stored, m_spState.get(), m_Error);
+		m_bDecoded = true;
+	}
+
+	DbColumnCodec::DbColumnCodec(int Threshold, std::shared_ptr<const IDbColumnCodec> spCodec)
+		: m_spState(std::make_shared<DbColumnCodecState>())
+	{
+		m_spState->iThreshold = std::max(0, Threshold);
+		m_spState->spCodec = spCodec ? spCodec : findCodec(DbZlibCodec().codecId());
+	}
+
+	QVariant DbColumnCodec::encode(const QVariant& Value) const
+	{
+		const bool bText = Value.userType() == QMetaType::QString;
+		if (Value.isNull() || (!bText && Value.userType() != QMetaType::QByteArray))
+			return Value;
+
+		QElapsedTimer Timer;
+		Timer.start();
+		m_spState->Encoded++;
+		const QByteArray Data = bText ? Value.toString().toUtf8() : Value.toByteArray();
+		if (Data.size() < m_spState->iThreshold)
+			return storeUncompressed(Value, Data, bText);
+
+		const QByteArray Compressed = m_spState->spCodec->compress(Data);
+		// values shrinking by less than 10% aren't worth decompressing on every read
+		if (Compressed.isEmpty() || HeaderSize + Compressed.size() > Data.size() - Data.size() / 10)
+		{
+			m_spState->EncodeNanoseconds += Timer.nsecsElapsed();
+			return storeUncompressed(Value, Data, bText);
+		}
+
+		QByteArray Stored = frame(m_spState->spCodec->codecId(), bText ? TextFlag : 0, Data.size(), Compressed);
+		m_spState->Compressed++;
+		m_spState->BytesIn += Data.size();
+		m_spState->BytesStored += Stored.size();
+		m_spState->EncodeNanoseconds += Timer.nsecsElapsed();
+		return Stored;
+	}
+
+	DbCompressedValue DbColumnCodec::decode(const QVariant& Stored) const
+	{
+		DbCompressedValue Ret;
+		Ret.m_Stored = Stored;
+		Ret.m_spState = m_spState;
+		return Ret;
+	}
+
+	DbCodecStatistics DbColumnCodec::statistics() const
+	{
+		DbCodecStatistics Ret;
+		Ret.Encoded = m_spState->Encoded;
+		Ret.Compressed = m_spState->Compressed;
+		Ret.Decoded = m_spState->Decoded;
+		Ret.BytesIn = m_spState->BytesIn;
+		Ret.BytesStored = m_spState->BytesStored;
+		Ret.EncodeNanoseconds = m_spState->EncodeNanoseconds;
+		Ret.DecodeNanoseconds = m_spState->DecodeNanoseconds;
+		return Ret;
+	}
+
+	QVariant DbColumnCodec::decodeValue(const QVariant& Stored, QString* pError)
+	{
+		QString Error;
+		QVariant Value = decodeStored(Stored, nullptr, Error);
+		if (pError)
+			*pError = Error;
+		return Value;
+	}
+
+	bool DbColumnCodec::isCompressed(const QByteArray& Stored)
+	{
+		return hasHeader(Stored) && static_cast<quint8>(Stored[3]) != StoredCodecId;
+	}
+
+	void DbColumnCodec::registerCodec(std::shared_ptr<const IDbColumnCodec> spCodec)
+	{
+		if (!spCodec || spCodec->codecId() == StoredCodecId)
+			return;
+		CodecRegistry& Registry = codecRegistry();
+		QWriteLocker Lock(&Registry.lCodecs);
+		Registry.Codecs[spCodec->codecId()] = spCodec;
+	}
+
+	void DbColumnCodecs::add(const DbCodecColumn& Column)
+	{
+		QWriteLocker Lock(&m_lColumns);
+		m_Columns[Column.Table.toLower() + '.' + Column.Column.toLower()] = Column;
+	}
+
+	bool DbColumnCodecs::find(const QString& Table, const QString& Column, DbColumnCodec& Codec) const
+	{
+		QReadLocker Lock(&m_lColumns);
+		auto It = m_Columns.find(Table.toLower() + '.' + Column.toLower());
+		if (It == m_Columns.end())
+			return false;
+		Codec = It->second.Codec;
+		return true;
+	}
+
+	void DbColumnCodecs::remove(const QString& Table, const QString& Column)
+	{
+		QWriteLocker Lock(&m_lColumns);
+		m_Columns.erase(Table.toLower() + '.' + Column.toLower());
+	}
+
+	QList<DbCodecStatistics> DbColumnCodecs::statistics() const
+	{
+		QList<DbCodecStatistics> Ret;
+		QReadLocker Lock(&m_lColumns);
+		for (const auto& Entry : m_Columns)
+		{
+			DbCodecStatistics Statistics = Entry.second.Codec.statistics();
+			Statistics.Table = Entry.second.Table;
+			Statistics.Column = Entry.second.Column;
+			Ret.append(Statistics);
+		}
+		return Ret;
+	}
+}
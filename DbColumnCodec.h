@@ -0,0 +1,147 @@
+#pragma once
+
+#include <QByteArray>
+#include <QList>
+#include <QMetaType>
+#include <QReadWriteLock>
+#include <QString>
+#include <QVariant>
+
+#include <map>
+#include <memory>
+
+namespace PortableDBBackend
+{
+	//! @brief IDbColumnCodec compresses the payload of a single value, the header is written by DbColumnCodec
+	class IDbColumnCodec
+	{
+	public:
+		virtual ~IDbColumnCodec() = default;
+
+		//! @brief stored in every compressed value, 1 is DbZlibCodec, 0 is reserved, use 128-255 for own codecs
+		virtual quint8 codecId() const = 0;
+		virtual QByteArray compress(const QByteArray& Data) const = 0;
+		//! @brief Data may reference the stored value without a copy
+		//! @return an empty array for corrupt data
+		virtual QByteArray decompress(const QByteArray& Data, int UncompressedSize) const = 0;
+	};
+
+	//! @brief zlib through qCompress/qUncompress
+	class DbZlibCodec : public IDbColumnCodec
+	{
+	public:
+		explicit DbZlibCodec(int CompressionLevel = 6);
+
+		virtual quint8 codecId() const override;
+		virtual QByteArray compress(const QByteArray& Data) const override;
+		virtual QByteArray decompress(const QByteArray& Data, int UncompressedSize) const override;
+
+	private:
+		int m_iCompressionLevel;
+	};
+
+	//! @brief compression ratio and codec time of one column, snapshot of DbColumnCodec::statistics()
+	struct DbCodecStatistics
+	{
+		QString Table;
+		QString Column;
+		quint64 Encoded = 0; //!< values passed to encode
+		quint64 Compressed = 0; //!< of those, values stored compressed
+		quint64 Decoded = 0; //!< compressed values read back
+		qint64 BytesIn = 0; //!< uncompressed size of the compressed values
+		qint64 BytesStored = 0; //!< their stored size including headers
+		qint64 EncodeNanoseconds = 0;
+		qint64 DecodeNanoseconds = 0;
+
+		double compressionRatio() const { return BytesStored > 0 ? static_cast<double>(BytesIn) / BytesStored : 1.0; }
+	};
+
+	struct DbColumnCodecState;
+
+	//! @brief DbCompressedValue holds a value as read from a codec column and decompresses it on first access
+	//! like QSqlQuery it isn't thread safe, copies made before the first access decompress independently
+	class DbCompressedValue
+	{
+	public:
+		DbCompressedValue() = default;
+
+		bool isNull() const;
+		bool isCompressed() const; //!< false for rows written below the threshold or before the column got a codec
+		int storedSize() const;
+		//! @brief true if the stored value has a header but can't be decoded (unknown codec, truncated or corrupt data)
+		//! the accessors below return null values then, decodes on first call like them
+		bool isCorrupt() const;
+		QString errorString() const;
+
+		QByteArray bytes() const; //!< text values as UTF-8
+		QString text() const;
+		QVariant value() const; //!< QString for text, QByteArray for blobs, the type encode was called with
+
+	private:
+		friend class DbColumnCodec;
+		void decodeOnce() const;
+
+		QVariant m_Stored;
+		std::shared_ptr<DbColumnCodecState> m_spState; //!< statistics of the column, nullptr for DbColumnCodec::decodeValue
+		mutable QVariant m_Decoded;
+		mutable QString m_Error;
+		mutable bool m_bDecoded = false;
+	};
+
+	//! @brief DbColumnCodec is the compression policy of one BLOB/TEXT column
+	//! values of at least Threshold bytes are compressed and prefixed with a small header (magic, codec id, flags, size),
+	//! everything else is stored as it is, so rows written before the column got a codec stay readable
+	//! copies share their statistics, all methods are thread safe
+	class DbColumnCodec
+	{
+	public:
+		//! @param Threshold smaller values are stored uncompressed
+		//! @param spCodec nullptr: DbZlibCodec, own codecs must be registered with registerCodec to be decodable
+		explicit DbColumnCodec(int Threshold = 4096, std::shared_ptr<const IDbColumnCodec> spCodec = nullptr);
+
+		//! @brief value to bind for a QByteArray or QString, other types are returned unchanged
+		QVariant encode(const QVariant& Value) const;
+		//! @brief Stored is the column value as read, decompression happens on first access of the result
+		DbCompressedValue decode(const QVariant& Stored) const;
+
+		DbCodecStatistics statistics() const;
+
+		//! @brief immediate decode without statistics, e.g. for code using DataBackend directly
+		//! @return a null QVariant for corrupt values, pError receives the reason
+		static QVariant decodeValue(const QVariant& Stored, QString* pError = nullptr);
+		static bool isCompressed(const QByteArray& Stored);
+		//! @brief makes values written by spCodec decodable, DbZlibCodec is always registered
+		static void registerCodec(std::shared_ptr<const IDbColumnCodec> spCodec);
+
+	private:
+		std::shared_ptr<DbColumnCodecState> m_spState;
+	};
+
+	//! @brief column declared by ITableDefinition::codecColumns
+	//! compressed values are BLOBs: FTS5, LIKE, comparisons and indexes see the compressed bytes,
+	//! so DbHandler ignores codecs on columns used by a DbFtsTableDefinition (AddTable) or an index of the opened database (InitializeDb)
+	struct DbCodecColumn
+	{
+		QString Table;
+		QString Column;
+		DbColumnCodec Codec;
+	};
+
+	//! @brief DbColumnCodecs maps table and column names (case insensitive) to their codec
+	class DbColumnCodecs
+	{
+	public:
+		void add(const DbCodecColumn& Column);
+		//! @return false if the column has no codec
+		bool find(const QString& Table, const QString& Column, DbColumnCodec& Codec) const;
+		void remove(const QString& Table, const QString& Column);
+		QList<DbCodecStatistics> statistics() const;
+
+	private:
+		mutable QReadWriteLock m_lColumns;
+		std::map<QString, DbCodecColumn> m_Columns; //!< key: table.column in lower case
+	};
+}
+
+Q_DECLARE_METATYPE(PortableDBBackend::DbCompressedValue);
+Q_DECLARE_METATYPE(PortableDBBackend::DbCodecStatistics);
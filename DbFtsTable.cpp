@@ -0,0 +1,138 @@
+#include "DbFtsTable.h"
+
+#include <QRegularExpression>
+
+namespace PortableDBBackend
+{
+	DbFtsTableDefinition::DbFtsTableDefinition(const QString& FtsTable, const QString& ContentTable, const QStringList& Columns,
+		const QString& ContentRowId, int IntroducedInVersion, int RebuildVersion)
+		: m_FtsTable(FtsTable)
+		, m_ContentTable(ContentTable)
+		, m_Columns(Columns)
+		, m_ContentRowId(ContentRowId)
+		, m_Tokenizer("unicode61 remove_diacritics 2")
+		, m_iIntroducedInVersion(IntroducedInVersion)
+		, m_iRebuildVersion(RebuildVersion)
+	{
+	}
+
+	void DbFtsTableDefinition::setTokenizer(const QString& Tokenizer)
+	{
+		m_Tokenizer = Tokenizer;
+	}
+
+	QString DbFtsTableDefinition::ftsTable() const
+	{
+		return m_FtsTable;
+	}
+
+	QString DbFtsTableDefinition::contentTable() const
+	{
+		return m_ContentTable;
+	}
+
+	QStringList DbFtsTableDefinition::columns() const
+	{
+		return m_Columns;
+	}
+
+	QString DbFtsTableDefinition::columnList(const QString& Prefix) const
+	{
+		QStringList Prefixed;
+		for (const QString& Column : m_Columns)
+		{
+			Prefixed.append(Prefix + Column);
+		}
+		return Prefixed.join(", ");
+	}
+
+	QStringList DbFtsTableDefinition::getCreateStatements(int /*TargetVersion*/) const
+	{
+		QStringList CreateList;
+		QString sCreate = QString("CREATE VIRTUAL TABLE %1 USING fts5(").arg(m_FtsTable);
+		sCreate += columnList(QString());
+		sCreate += QString(", content='%1', content_rowid='%2'").arg(m_ContentTable, m_ContentRowId);
+		sCreate += QString(", tokenize='%1'").arg(m_Tokenizer);
+		sCreate += ");";
+		CreateList.append(sCreate);
+		CreateList.append(triggerStatements());
+		return CreateList;
+	}
+
+	QStringList DbFtsTableDefinition::triggerStatements() const
+	{
+		// external content: the index stores no text, 'delete' needs the old values to find the tokens to remove
+		const QString sInsertNew = QString("INSERT INTO %1(rowid, %2) VALUES (new.%3, %4);")
+			.arg(m_FtsTable, columnList(QString()), m_ContentRowId, columnList("new."));
+		const QString sDeleteOld = QString("INSERT INTO %1(%1, rowid, %2) VALUES ('delete', old.%3, %4);")
+			.arg(m_FtsTable, columnList(QString()), m_ContentRowId, columnList("old."));
+
+		QStringList Triggers;
+		Triggers.append(QString("CREATE TRIGGER %1_ai AFTER INSERT ON %2 BEGIN %3 END;")
+			.arg(m_FtsTable, m_ContentTable, sInsertNew));
+		Triggers.append(QString("CREATE TRIGGER %1_ad AFTER DELETE ON %2 BEGIN %3 END;")
+			.arg(m_FtsTable, m_ContentTable, sDeleteOld));
+		// only updates of indexed columns cost index work
+		Triggers.append(QString("CREATE TRIGGER %1_au AFTER UPDATE OF %2 ON %3 BEGIN %4 %5 END;")
+			.arg(m_FtsTable, columnList(QString()), m_ContentTable, sDeleteOld, sInsertNew));
+		return Triggers;
+	}
+
+	bool DbFtsTableDefinition::NeedUpdate(int OldVersion, int UpdatedVersion) const
+	{
+		bool bRet = false;
+		if (OldVersion < m_iIntroducedInVersion && m_iIntroducedInVersion <= UpdatedVersion)
+			bRet = true;
+		if (m_iRebuildVersion > 0 && OldVersion < m_iRebuildVersion && m_iRebuildVersion <= UpdatedVersion)
+			bRet = true;
+		return bRet;
+	}
+
+	QStringList DbFtsTableDefinition::getUpdateStatement(int OldVersion, int TargetVersion) const
+	{
+		QStringList sCmdLst;
+		if (OldVersion < m_iIntroducedInVersion)
+		{
+			sCmdLst.append(getCreateStatements(TargetVersion));
+		}
+		// fills a new index from the existing content, or re-tokenizes everything
+		sCmdLst.append(QString("INSERT INTO %1(%1) VALUES ('rebuild');").arg(m_FtsTable));
+		sCmdLst.append(QString("INSERT INTO %1(%1) VALUES ('optimize');").arg(m_FtsTable));
+		return sCmdLst;
+	}
+
+	QStringList DbFtsTableDefinition::getDeleteStatements() const
+	{
+		QStringList Empty;
+		return Empty;
+	}
+
+	QStringList DbFtsTableDefinition::insertInitialRows(int /*TargetVersion*/) const
+	{
+		QStringList List;
+		List.append(QString("INSERT INTO %1(%1) VALUES ('rebuild');").arg(m_FtsTable));
+		return List;
+	}
+
+	QString DbFtsTableDefinition::searchSql(const QString& FtsTable)
+	{
+		// ORDER BY rank lets FTS5 sort by bm25 internally
+		return QString("SELECT rowid, *, rank FROM %1 WHERE %1 MATCH ? ORDER BY rank LIMIT ? OFFSET ?;").arg(FtsTable);
+	}
+
+	QString DbFtsTableDefinition::matchExpressionFromUserInput(const QString& UserInput)
+	{
+		QStringList Terms;
+		const QStringList Words = UserInput.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+		for (int i = 0; i < Words.size(); i++)
+		{
+			QString sTerm = Words[i];
+			sTerm.replace("\"", "\"\"");
+			sTerm = "\"" + sTerm + "\"";
+			if (i == Words.size() - 1)
+				sTerm += "*"; // search as you type
+			Terms.append(sTerm);
+		}
+		return Terms.join(" ");
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "databackend.h"
+
+#include <QString>
+#include <QStringList>
+
+namespace PortableDBBackend
+{
+	//! @brief DbFtsTableDefinition declares an FTS5 index mirroring columns of an existing content table
+	//! the index is an external content table kept up to date by triggers on the content table,
+	//! so writes only touch the changed rows and handlers don't have to know about the index at all
+	//! add it after its content table, DbHandler::searchFullText queries it
+	//! REPLACE/INSERT OR REPLACE on the content table relies on PRAGMA recursive_triggers, which DataBackend turns on for every connection
+	class DbFtsTableDefinition : public ITableDefinition
+	{
+	public:
+		//! @param FtsTable name of the virtual table
+		//! @param ContentTable table holding the indexed text
+		//! @param Columns indexed columns of ContentTable
+		//! @param ContentRowId integer primary key of ContentTable
+		//! @param IntroducedInVersion Db version that added the index, older files get it created (and filled) by RunUpdates
+		//! @param RebuildVersion updating a file across this version rebuilds the index, e.g. after tokenizer changes, 0 = never
+		DbFtsTableDefinition(const QString& FtsTable, const QString& ContentTable, const QStringList& Columns,
+			const QString& ContentRowId = QString("rowid"), int IntroducedInVersion = 0, int RebuildVersion = 0);
+
+		//! @brief FTS5 tokenizer declaration, default "unicode61 remove_diacritics 2"
+		void setTokenizer(const QString& Tokenizer);
+
+		QString ftsTable() const;
+		QString contentTable() const;
+		QStringList columns() const; //!< indexed columns of the content table
+
+		// ITableDefinition
+		virtual QStringList getCreateStatements(int TargetVersion) const override;
+		virtual bool NeedUpdate(int OldVersion, int UpdatedVersion) const override;
+		virtual QStringList getUpdateStatement(int OldVersion, int TargetVersion) const override;
+		//! empty: the delete triggers of the content table keep the index in sync,
+		//! and DeleteAllData rebuilds it afterwards through insertInitialRows
+		virtual QStringList getDeleteStatements() const override;
+		//! rebuilds the index from rows inserted before the triggers existed
+		virtual QStringList insertInitialRows(int TargetVersion) const override;
+
+		//! @brief ranked and paged search, binds: match expression, limit, offset
+		//! FtsTable is inserted into the SQL text unquoted, pass ftsTable() of a definition only
+		//! result columns: rowid, the indexed columns, rank (bm25, lower is better)
+		static QString searchSql(const QString& FtsTable);
+		//! @brief turns free text of a search box into a safe FTS5 query: every word quoted, the last one as prefix
+		static QString matchExpressionFromUserInput(const QString& UserInput);
+
+	private:
+		QString m_FtsTable;
+		QString m_ContentTable;
+		QStringList m_Columns;
+		QString m_ContentRowId;
+		QString m_Tokenizer;
+		int m_iIntroducedInVersion;
+		int m_iRebuildVersion;
+
+		QStringList triggerStatements() const;
+		QString columnList(const QString& Prefix) const;
+	};
+}
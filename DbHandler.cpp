@@ -1,26 +1,125 @@
 #include "DbHandler.h"
 #include "DbHandlerPrivate.h"
 
+#include <QElapsedTimer>
+#include <QSqlQuery>
+
 
 
 namespace PortableDBBackend
 {
+	bool DbDataHandlerBase::publishRowSet(QSqlDatabase& Db, const QString& Sql, const QVariantList& BindValues)
+	{
+		QElapsedTimer Timer;
+		Timer.start();
+		DbRowSet RowSet = DbRowSet::fromSql(Db, Sql, BindValues);
+		recordStatement(Db, Sql, Timer.nsecsElapsed());
+		if (!RowSet.isValid())
+		{
+			emit DbError(RowSet.errorString(), DbErrorCode::General);
+			return false;
+		}
+		emit DbRowSetReady(uuid(), RowSet);
+		return true;
+	}
+
+	bool DbDataHandlerBase::execQuery(QSqlDatabase& Db, QSqlQuery& Query) const
+	{
+		QElapsedTimer Timer;
+		Timer.start();
+		const bool bSuccess = Query.exec();
+		recordStatement(Db, Query.lastQuery(), Timer.nsecsElapsed());
+		return bSuccess;
+	}
+
+	void DbDataHandlerBase::recordStatement(QSqlDatabase& Db, const QString& Sql, qint64 Nanoseconds) const
+	{
+		// the trace hook already counted statements on its own connection
+		if (m_spQueryPlanAdvisor && m_spQueryPlanAdvisor->isEnabled() && !m_spQueryPlanAdvisor->tracesConnection(Db.connectionName()))
+		{
+			m_spQueryPlanAdvisor->record(Sql, Nanoseconds);
+		}
+	}
+
+	QVariant DbDataHandlerBase::encodeColumn(const QString& Table, const QString& Column, const QVariant& Value) const
+	{
+		DbColumnCodec Codec;
+		if (m_spColumnCodecs && m_spColumnCodecs->find(Table, Column, Codec))
+			return Codec.encode(Value);
+		return Value;
+	}
+
+	DbCompressedValue DbDataHandlerBase::decodeColumn(const QString& Table, const QString& Column, const QVariant& Stored) const
+	{
+		DbColumnCodec Codec;
+		if (m_spColumnCodecs && m_spColumnCodecs->find(Table, Column, Codec))
+			return Codec.decode(Stored);
+		// not declared (anymore), the header still tells whether Stored is compressed
+		return DbColumnCodec().decode(Stored);
+	}
 
-	DbHandler::DbHandler()
-		: m_pImpl(std::make_unique<DbHandlerPrivate>())
+	bool DbDataHandlerBase::decodeColumnValue(const QString& Table, const QString& Column, const QVariant& Stored, QVariant& Value)
+	{
+		const DbCompressedValue Decoded = decodeColumn(Table, Column, Stored);
+		Value = Decoded.value();
+		if (Decoded.isCorrupt())
+		{
+			emit DbError(QString("%1.%2: %3").arg(Table, Column, Decoded.errorString()), DbErrorCode::General);
+			return false;
+		}
+		return true;
+	}
+
+	QString DbDataHandlerBase::partitionForWrite(QSqlDatabase& Db, const QString& Table, const QDateTime& Timestamp, DbPartitionStatus* pStatus) const
+	{
+		if (m_spPartitions)
+			return m_spPartitions->writeTable(Db, Table, Timestamp, pStatus);
+		if (pStatus)
+		{
+			*pStatus = DbPartitionStatus::UnknownTable;
+		}
+		return QString();
+	}
+
+	bool DbDataHandlerBase::forEachPartition(QSqlDatabase& Db, const QString& Table, const QDateTime& From, const QDateTime& To,
+		const std::function<bool(const QString& QualifiedTable)>& Visit) const
+	{
+		return m_spPartitions && m_spPartitions->forEachPartition(Db, Table, From, To, Visit);
+	}
+
+	DbHandler::DbHandler(DbExecutionModel ExecutionModel)
+		: m_pImpl(std::make_unique<DbHandlerPrivate>(ExecutionModel))
 	{
 		connect(m_pImpl.get(), &DbHandlerPrivate::DbError, this, &DbHandler::DbError);
 		connect(m_pImpl.get(), &DbHandlerPrivate::DbReady, this, &DbHandler::DbReady);
+		connect(m_pImpl.get(), &DbHandlerPrivate::DbTemplateDatabaseCreated, this, &DbHandler::DbTemplateDatabaseCreated);
 		connect(m_pImpl.get(), &DbHandlerPrivate::DbReadAllFinishedForHandler, this, &DbHandler::DbReadAllFinishedForHandler);
+		connect(m_pImpl.get(), &DbHandlerPrivate::DbReadAllFinished, this, &DbHandler::DbReadAllFinished);
+		connect(m_pImpl.get(), &DbHandlerPrivate::DbQueueOverflow, this, &DbHandler::DbQueueOverflow);
+		connect(m_pImpl.get(), &DbHandlerPrivate::DbOperationAbandoned, this, &DbHandler::DbOperationAbandoned);
+		connect(m_pImpl.get(), &DbHandlerPrivate::DbFullTextSearchFinished, this, &DbHandler::DbFullTextSearchFinished);
+		connect(m_pImpl.get(), &DbHandlerPrivate::DbQueryPlanReportReady, this, &DbHandler::DbQueryPlanReportReady);
+		connect(m_pImpl.get(), &DbHandlerPrivate::DbCheckpointFinished, this, &DbHandler::DbCheckpointFinished);
+		connect(m_pImpl.get(), &DbHandlerPrivate::DbMemoryUsageReport, this, &DbHandler::DbMemoryUsageReport);
 	}
 
 	DbHandler::~DbHandler()
 	{
 	}
 
-	void DbHandler::AddTable(std::unique_ptr<ITableDefinition> Table)
+	void DbHandler::setSharedExecutorThreadCount(int ThreadCount)
+	{
+		DbSharedExecutor::instance().setThreadCount(ThreadCount);
+	}
+
+	bool DbHandler::AddTable(std::unique_ptr<ITableDefinition> Table)
+	{
+		return m_pImpl->AddTable(std::move(Table));
+	}
+
+	bool DbHandler::AddPartitionedTable(const DbTimePartitionedTable& Table)
 	{
-		m_pImpl->AddTable(std::move(Table));
+		return m_pImpl->AddPartitionedTable(Table);
 	}
 
 	void DbHandler::setDbVersion(int DbVersion)
@@ -28,6 +127,16 @@ namespace PortableDBBackend
 		m_pImpl->setDbVersion(DbVersion);
 	}
 
+	void DbHandler::setTemplateDatabase(const QString& TemplateFilename)
+	{
+		m_pImpl->setTemplateDatabase(TemplateFilename);
+	}
+
+	void DbHandler::createTemplateDatabase(const QString& TemplateFilename)
+	{
+		m_pImpl->createTemplateDatabase(TemplateFilename);
+	}
+
 	void DbHandler::InitializeDb(const QString & ProposedFilename)
 	{
 		m_pImpl->InitializeDb(ProposedFilename);
@@ -48,11 +157,81 @@ namespace PortableDBBackend
 		m_pImpl->registerHandler(spHandler);
 	}
 
+	void DbHandler::setReadAllConcurrency(int MaxParallelReads)
+	{
+		m_pImpl->setReadAllConcurrency(MaxParallelReads);
+	}
+
 	QSharedPointer<DbDataHandlerBase> DbHandler::getHandler(QUuid handlerUuid)
 	{
 		return m_pImpl->getHandler(handlerUuid);
 	}
 
+	void DbHandler::queueOperation(DbOperationType Type, QUuid handlerUuid, QVariant value, const DbOperationOptions& Options)
+	{
+		m_pImpl->queueOperation(Type, handlerUuid, value, Options);
+	}
+
+	QUuid DbHandler::searchFullText(const QString& FtsTable, const QString& MatchExpression, int Offset, int Limit, const DbOperationOptions& Options)
+	{
+		return m_pImpl->searchFullText(FtsTable, MatchExpression, Offset, Limit, Options);
+	}
+
+	void DbHandler::setQueryDiagnostics(bool bEnabled)
+	{
+		m_pImpl->setQueryDiagnostics(bEnabled);
+	}
+
+	void DbHandler::requestQueryPlanReport(const DbOperationOptions& Options)
+	{
+		m_pImpl->requestQueryPlanReport(Options);
+	}
+
+	void DbHandler::readAllHandlers(const DbOperationOptions& Options)
+	{
+		m_pImpl->readAllHandlers(Options);
+	}
+
+	void DbHandler::setCheckpointSettings(const DbCheckpointSettings& Settings)
+	{
+		m_pImpl->setCheckpointSettings(Settings);
+	}
+
+	void DbHandler::setMemoryBudget(qint64 Bytes)
+	{
+		m_pImpl->setMemoryBudget(Bytes);
+	}
+
+	void DbHandler::releaseMemory()
+	{
+		m_pImpl->releaseMemory();
+	}
+
+	void DbHandler::requestMemoryUsage()
+	{
+		m_pImpl->requestMemoryUsage();
+	}
+
+	void DbHandler::setWriteBatchSize(int OperationsPerTransaction)
+	{
+		m_pImpl->setWriteBatchSize(OperationsPerTransaction);
+	}
+
+	void DbHandler::setQueueLimits(const DbQueueLimits& Limits)
+	{
+		m_pImpl->setQueueLimits(Limits);
+	}
+
+	DbQueueStatistics DbHandler::queueStatistics() const
+	{
+		return m_pImpl->queueStatistics();
+	}
+
+	QList<DbCodecStatistics> DbHandler::codecStatistics() const
+	{
+		return m_pImpl->codecStatistics();
+	}
+
 	void DbHandler::updateInDb(QUuid handlerUuid, QVariant value)
 	{
 		m_pImpl->updateInDb(handlerUuid, value);
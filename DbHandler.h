@@ -1,12 +1,21 @@
 #pragma once
 
+#include <QDeadlineTimer>
 #include <QObject>
 #include <QPointer>
 #include <QVariant>
 #include <QUuid>
 
 #include "databackend.h"
+#include "DbCheckpointScheduler.h"
+#include "DbColumnCodec.h"
+#include "DbPartitionedTable.h"
+#include "DbQueryPlanAdvisor.h"
+#include "DbRowSet.h"
+#include "DbTransaction.h"
 
+#include <atomic>
+#include <functional>
 #include <memory>
 
 namespace PortableDBBackend
@@ -15,7 +24,127 @@ namespace PortableDBBackend
 	enum class DbErrorCode
 	{
 		Success = 0,
-		General = 1
+		General = 1,
+		QueueFull = 2 //!< an operation was rejected or dropped by the operation queue
+	};
+
+	//! @brief handler operations which DbHandler forwards to the Db thread
+	enum class DbOperationType
+	{
+		Save,
+		Update,
+		Delete,
+		Read,
+		ReadAll
+	};
+
+	//! @brief memory held by the backend per component, in bytes, -1 if it can't be measured in this build
+	struct DbMemoryUsage
+	{
+		qint64 Budget = 0; //!< 0: no budget set
+		qint64 PageCacheMain = 0; //!< page cache of the Db thread connection
+		qint64 PageCacheReaders = 0; //!< page caches of the readAll connections
+		qint64 SqliteHeap = -1; //!< all memory allocated by SQLite in this process (PORTABLEDB_USE_SQLITE_API only)
+		qint64 OperationQueue = 0; //!< estimated payload of queued operations
+	};
+
+	//! @brief where DbHandler executes database work, fixed at construction
+	enum class DbExecutionModel
+	{
+		DedicatedThread, //!< one private thread per DbHandler (default)
+		SharedExecutor, //!< a thread of a small process wide pool, see DbHandler::setSharedExecutorThreadCount
+		Inline //!< synchronously on the thread that created the DbHandler (calls from other threads are skipped with DbError, QSqlDatabase can't change threads), no operation queue and no event loop hops
+	};
+
+	//! @brief decides what happens to an operation that doesn't fit into the operation queue
+	enum class DbQueueOverflowPolicy
+	{
+		BlockProducer, //!< wait until the Db thread made room, calls from the Db thread itself are never blocked
+		Reject, //!< drop the new operation and report DbErrorCode::QueueFull
+		DropOldest, //!< drop queued operations from the front until the new one fits
+		Coalesce //!< replace a queued operation with equal handler, type and DbDataHandlerBase::coalesceKey(), reject if there is none
+	};
+
+	//! @brief capacity of the queue between DbHandler and the Db thread, 0 means unlimited
+	struct DbQueueLimits
+	{
+		int MaxOperations = 0;
+		qint64 MaxBytes = 0; //!< estimated payload size, a single operation exceeding it is still accepted into an empty queue
+		DbQueueOverflowPolicy Policy = DbQueueOverflowPolicy::BlockProducer;
+	};
+
+	//! @brief why an operation passed with DbOperationOptions didn't run (to the end)
+	enum class DbAbandonReason
+	{
+		Expired, //!< the deadline passed before the operation started
+		Cancelled, //!< the token was cancelled before the operation started
+		Interrupted //!< a running Read/ReadAll/search was stopped, PORTABLEDB_USE_SQLITE_API only
+	};
+
+	//! @brief DbCancellationToken withdraws operations queued with DbOperationOptions
+	//! a default constructed token never cancels, create() returns one that can, copies share their state
+	class DbCancellationToken
+	{
+	public:
+		DbCancellationToken() = default;
+
+		static DbCancellationToken create()
+		{
+			DbCancellationToken Token;
+			Token.m_spCancelled = std::make_shared<std::atomic<bool>>(false);
+			return Token;
+		}
+
+		void cancel() { if (m_spCancelled) *m_spCancelled = true; }
+		bool isCancelled() const { return m_spCancelled && *m_spCancelled; }
+		bool canBeCancelled() const { return m_spCancelled != nullptr; }
+
+	private:
+		std::shared_ptr<std::atomic<bool>> m_spCancelled;
+	};
+
+	//! @brief deadline and cancellation of a single operation, see DbHandler::queueOperation
+	//! the default build only drops operations that haven't started yet, a running statement can only be
+	//! interrupted with PORTABLEDB_USE_SQLITE_API (sqlite3_progress_handler), QtSql has no way to stop it
+	struct DbOperationOptions
+	{
+		QDeadlineTimer Deadline = QDeadlineTimer(QDeadlineTimer::Forever); //!< not started by then: dropped, reads running past it: interrupted (SQLite API only)
+		DbCancellationToken Cancellation;
+
+		bool isInterruptible() const { return !Deadline.isForever() || Cancellation.canBeCancelled(); }
+		//! @return true if the operation must not run (any longer)
+		bool isAbandoned(DbAbandonReason& Reason) const
+		{
+			if (Cancellation.isCancelled())
+			{
+				Reason = DbAbandonReason::Cancelled;
+				return true;
+			}
+			if (Deadline.hasExpired())
+			{
+				Reason = DbAbandonReason::Expired;
+				return true;
+			}
+			return false;
+		}
+	};
+
+	//! @brief snapshot of the operation queue, use it to size DbQueueLimits
+	struct DbQueueStatistics
+	{
+		int Depth = 0;
+		qint64 Bytes = 0;
+		int PeakDepth = 0;
+		qint64 PeakBytes = 0;
+		quint64 Enqueued = 0;
+		quint64 Executed = 0;
+		quint64 Blocked = 0; //!< producer calls that had to wait
+		quint64 Rejected = 0;
+		quint64 Dropped = 0;
+		quint64 Coalesced = 0;
+		quint64 Expired = 0; //!< dropped on the Db thread instead of executed, see DbOperationOptions
+		quint64 Cancelled = 0;
+		quint64 Interrupted = 0;
 	};
 
 	class DbHandlerPrivate;
@@ -39,14 +168,54 @@ namespace PortableDBBackend
 		virtual void databaseClosed() {};
 
 		// operation
+		//! writes spanning several rows should be wrapped in a DbTransaction on Db, it nests into a batch of DbHandler::setWriteBatchSize
 		virtual void saveToDb(QVariant /*value*/, QSqlDatabase& /*Db*/) {};
 		virtual void updateInDb(QVariant /*value*/, QSqlDatabase& /*Db*/) {};
 		virtual void deleteInDb(QVariant /*value*/, QSqlDatabase& /*Db*/) {};
 		virtual void readFromDb(QVariant /*value*/, QSqlDatabase& /*Db*/) {};
 		virtual void readAll(QSqlDatabase& /*Db*/) {};
 
+		//! @brief key used by DbQueueOverflowPolicy::Coalesce, e.g. the primary key contained in value
+		//! the newest queued operation of this handler with the same key is replaced if it has the same type, an invalid key never coalesces
+		virtual QVariant coalesceKey(DbOperationType /*Type*/, const QVariant& /*value*/) const { return QVariant(); }
+
 	signals:
 		void DbError(const QString& ErrorDsc, DbErrorCode ErrorCode);
+		//! @brief result of publishRowSet, the DbRowSet buffers are shared, not copied, across queued connections
+		void DbRowSetReady(QUuid handlerUuid, const DbRowSet& RowSet);
+
+	protected:
+		//! @brief helper for bulk reads (typically from readAll): runs Sql on Db and emits DbRowSetReady or DbError
+		//! DbRowSet columns with a codec hold the stored bytes, the receiver decodes them with decodeColumn
+		bool publishRowSet(QSqlDatabase& Db, const QString& Sql, const QVariantList& BindValues = QVariantList());
+		//! @brief Query.exec() on the connection Db, recorded for DbHandler::requestQueryPlanReport while query diagnostics are on
+		//! use it for the statements worth explaining, plain QSqlQuery::exec is only seen with PORTABLEDB_USE_SQLITE_API
+		bool execQuery(QSqlDatabase& Db, QSqlQuery& Query) const;
+
+		//! @brief value to bind for Table.Column, compressed if the column is declared in ITableDefinition::codecColumns
+		//! Value is returned unchanged for other columns or before the handler is registered
+		QVariant encodeColumn(const QString& Table, const QString& Column, const QVariant& Value) const;
+		//! @brief Stored as read from Table.Column, decompressed on first access, uncompressed rows are passed through
+		DbCompressedValue decodeColumn(const QString& Table, const QString& Column, const QVariant& Stored) const;
+		//! @brief immediate decodeColumn, a corrupt value is reported with DbError and leaves Value null
+		bool decodeColumnValue(const QString& Table, const QString& Column, const QVariant& Stored, QVariant& Value);
+
+		//! @brief qualified table ("schema.table") of the partition a row with Timestamp belongs to, empty on failure, see pStatus
+		//! on DbPartitionStatus::InTransaction return, DbHandler undoes the operation and runs it again outside of its write batch
+		QString partitionForWrite(QSqlDatabase& Db, const QString& Table, const QDateTime& Timestamp, DbPartitionStatus* pStatus = nullptr) const;
+		//! @brief calls Visit for every existing partition of Table overlapping [From, To], oldest first
+		//! only partitions within the range are attached, queries on a partition must be finished when Visit returns
+		//! must not be called within a DbTransaction, readAll and readFromDb are fine
+		bool forEachPartition(QSqlDatabase& Db, const QString& Table, const QDateTime& From, const QDateTime& To,
+			const std::function<bool(const QString& QualifiedTable)>& Visit) const;
+
+	private:
+		friend class DbHandlerPrivate;
+		std::shared_ptr<const DbColumnCodecs> m_spColumnCodecs; //!< set by registerHandler
+		std::shared_ptr<DbPartitionManager> m_spPartitions; //!< set by registerHandler
+		std::shared_ptr<DbQueryPlanAdvisor> m_spQueryPlanAdvisor; //!< set by registerHandler
+
+		void recordStatement(QSqlDatabase& Db, const QString& Sql, qint64 Nanoseconds) const;
 	};
 
 	//! @brief DbHandler provides an interface to Db which runs in its own thread
@@ -58,29 +227,102 @@ namespace PortableDBBackend
 	{
 		Q_OBJECT
 	public:
-		DbHandler();
+		explicit DbHandler(DbExecutionModel ExecutionModel = DbExecutionModel::DedicatedThread);
 		virtual ~DbHandler();
 
+		//! @brief number of threads shared by all DbHandler using DbExecutionModel::SharedExecutor
+		//! only affects threads that aren't yet started, call it before creating the first shared DbHandler
+		static void setSharedExecutorThreadCount(int ThreadCount);
+
 		// Database definition
 		//! add definition for database tables
 		template <class TableType> void addTableType()
 		{
 			AddTable(std::unique_ptr<ITableDefinition>(new TableType));
 		}
-		void AddTable(std::unique_ptr<ITableDefinition> Table);
+		//! @return false (and DbError) for a definition that isn't ITableDefinition::isValid, e.g. clashing aggregate columns
+		bool AddTable(std::unique_ptr<ITableDefinition> Table);
+		//! @brief append-mostly table stored as one ATTACHed file per period, see DbTimePartitionedTable
+		//! handlers write with DbDataHandlerBase::partitionForWrite and read with DbDataHandlerBase::forEachPartition
+		//! @return false (and DbError) for an invalid table name or more tables than DbPartitionManager::MaxPartitionedTables
+		bool AddPartitionedTable(const DbTimePartitionedTable& Table);
 		
 		//! set the current Db schema version
 		void setDbVersion(int DbVersion);
 
+		//! @brief a new Db file is copied from TemplateFilename (e.g. ":/db/template.sqlite") instead of running all create and insert statements
+		//! a template not matching the current tables and version is ignored, see DataBackend::SchemaFingerprint
+		void setTemplateDatabase(const QString& TemplateFilename);
+		//! @brief build step: writes the template for the registered tables and version, answered by DbTemplateDatabaseCreated
+		//! the library has no generator target: the app's build runs its own tool adding the same tables, then bundles the file
+		void createTemplateDatabase(const QString& TemplateFilename);
+
 		void InitializeDb(const QString& ProposedFilename);
 		void DeleteAllData();
 		void closeDb();
 
 		void registerHandler(QSharedPointer<DbDataHandlerBase> spHandler);
 
+		//! @brief set the number of additional read connections used by readAll()
+		//! 0 (default) runs all readAll calls one after another on the Db thread
+		//! any other value opens up to MaxParallelReads read-only connections, each in its own thread,
+		//! handlers must then tolerate readAll being called concurrently to operations of other handlers
+		void setReadAllConcurrency(int MaxParallelReads);
+
 		//! @brief will return nullptr for unknown Uuids
 		QSharedPointer<DbDataHandlerBase> getHandler(QUuid handlerUuid);
 
+		//! @brief queues a handler operation that is dropped instead of executed once its deadline passed or it was cancelled
+		//! only with PORTABLEDB_USE_SQLITE_API running Read and ReadAll operations are interrupted as well
+		//! ReadAll with a null handlerUuid reads all handlers like readAll(), abandoned handlers still count as finished
+		void queueOperation(DbOperationType Type, QUuid handlerUuid, QVariant value, const DbOperationOptions& Options);
+
+		//! @brief ranked, paged full text search on an FTS5 table declared with DbFtsTableDefinition
+		//! MatchExpression uses FTS5 query syntax, see DbFtsTableDefinition::matchExpressionFromUserInput for search box input
+		//! FtsTable must name a table added with AddTable, other names fail with DbError and an invalid result
+		//! an abandoned search (see DbOperationOptions) reports an invalid result
+		//! @return id reported with DbFullTextSearchFinished
+		QUuid searchFullText(const QString& FtsTable, const QString& MatchExpression, int Offset, int Limit,
+			const DbOperationOptions& Options = DbOperationOptions());
+
+		//! @brief diagnostic mode: record every distinct statement with execution count and time
+		//! the default build only sees statements handlers run through DbDataHandlerBase::execQuery and publishRowSet,
+		//! with PORTABLEDB_USE_SQLITE_API every statement on the Db thread connection, see DbQueryPlanAdvisor
+		void setQueryDiagnostics(bool bEnabled);
+		//! @brief explains all recorded statements on the Db thread, answered by DbQueryPlanReportReady
+		//! once abandoned the report only covers the statements explained so far
+		void requestQueryPlanReport(const DbOperationOptions& Options = DbOperationOptions());
+		//! @brief readAll() with a deadline and cancellation shared by all handlers, same as queueOperation(ReadAll, QUuid(), ...)
+		void readAllHandlers(const DbOperationOptions& Options);
+
+		//! @brief let the Db thread checkpoint the WAL itself instead of SQLite doing it within a random commit
+		//! passive checkpoints run once the operation queue is idle, a WAL above the budget escalates to restart/truncate
+		void setCheckpointSettings(const DbCheckpointSettings& Settings);
+
+		//! @brief global memory budget, split into page cache of the Db thread connection (50%), page caches of
+		//! the readAll connections (20%), operation queue bytes (20%) and headroom for statements (10%)
+		//! the SQLite share also sets the process wide soft heap limit, 0 removes the budget
+		void setMemoryBudget(qint64 Bytes);
+		//! @brief frees unused SQLite memory of the Db thread connection, readAll connections shrink after every read while a budget is set
+		void releaseMemory();
+		//! @brief measures all components on their threads, answered by DbMemoryUsageReport
+		void requestMemoryUsage();
+
+		//! @brief group up to OperationsPerTransaction queued save/update/delete operations into one transaction
+		//! saves one commit (and fsync) per operation at the cost of losing the uncommitted batch on a crash
+		//! handlers using DbTransaction get a savepoint within the batch, 0 (default) commits every operation on its own
+		//! if the batch fails to commit and is rolled back its operations are run again one by one, so handlers see their own failures
+		//! handlers calling QSqlDatabase::transaction()/commit() themselves would commit the batch early, switch them to DbTransaction first
+		//! ignored by DbExecutionModel::Inline which has no queue to batch
+		void setWriteBatchSize(int OperationsPerTransaction);
+
+		//! @brief bound the queue between the calling threads and the Db thread, unlimited by default
+		void setQueueLimits(const DbQueueLimits& Limits);
+		DbQueueStatistics queueStatistics() const;
+
+		//! @brief compression ratio and codec time of every column declared in ITableDefinition::codecColumns
+		QList<DbCodecStatistics> codecStatistics() const;
+
 	public slots:
 		void saveToDb(QUuid handlerUuid, QVariant value);
 		void updateInDb(QUuid handlerUuid, QVariant value);
@@ -92,11 +334,24 @@ namespace PortableDBBackend
 	signals:
 		void DbError(const QString& ErrorDsc, DbErrorCode ErrorCode);
 		void DbReady();
+		void DbTemplateDatabaseCreated(const QString& TemplateFilename, bool bSuccess);
 		void DbReadAllFinishedForHandler(QUuid handlerUuid); //  indicates that the readAll function from this handler has reported all its data
+		void DbReadAllFinished(); //!< indicates that every handler queried by one readAll() call has reported all its data, emitted once per call
+		void DbFullTextSearchFinished(QUuid SearchId, const DbRowSet& Result); //!< rows: rowid, indexed columns, rank
+		void DbQueryPlanReportReady(const DbQueryPlanReport& Report); //!< most expensive statements first
+		void DbCheckpointFinished(const DbCheckpointStatistics& Statistics); //!< WAL size and duration of every scheduled checkpoint
+		void DbMemoryUsageReport(const DbMemoryUsage& Usage); //!< answer to requestMemoryUsage, also emitted when memory was released under pressure
+		void DbQueueOverflow(DbQueueOverflowPolicy Policy, DbOperationType Type, QUuid handlerUuid); //!< an operation of handlerUuid was rejected, dropped or coalesced
+		void DbOperationAbandoned(DbOperationType Type, QUuid handlerUuid, DbAbandonReason Reason); //!< see DbOperationOptions, an abandoned ReadAll still reports DbReadAllFinishedForHandler
 
 	private:
 		std::unique_ptr<DbHandlerPrivate> m_pImpl;
 	};
 
 }
-Q_DECLARE_METATYPE(QSharedPointer<PortableDBBackend::DbDataHandlerBase>);
\ No newline at end of file
+Q_DECLARE_METATYPE(QSharedPointer<PortableDBBackend::DbDataHandlerBase>);
+Q_DECLARE_METATYPE(PortableDBBackend::DbOperationType);
+Q_DECLARE_METATYPE(PortableDBBackend::DbMemoryUsage);
+Q_DECLARE_METATYPE(PortableDBBackend::DbQueueOverflowPolicy);
+Q_DECLARE_METATYPE(PortableDBBackend::DbAbandonReason);
+Q_DECLARE_METATYPE(PortableDBBackend::DbOperationOptions);
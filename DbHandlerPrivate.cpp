@@ -1,60 +1,314 @@
 #include "DbHandlerPrivate.h"
+#include "DbFtsTable.h"
+#include "DbSqliteApi.h"
 
 #include <QUuid>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QElapsedTimer>
+
+#include <algorithm>
 
 namespace PortableDBBackend
 {
-	DbHandlerPrivate::DbHandlerPrivate()
+	namespace
+	{
+		//! @brief "table.column" (lower case) of every column Table feeds into an FTS5 table
+		//! indexes are only known once the database is open, see ThreadedDbHandler::removeIndexedCodecs
+		std::set<QString> searchedColumns(const ITableDefinition& Table)
+		{
+			std::set<QString> Columns;
+			if (const DbFtsTableDefinition* pFts = dynamic_cast<const DbFtsTableDefinition*>(&Table))
+			{
+				for (const QString& Column : pFts->columns())
+				{
+					Columns.insert(pFts->contentTable().toLower() + '.' + Column.toLower());
+				}
+			}
+			return Columns;
+		}
+
+		//! @brief true if an index of the open database Db covers Table.Column, expressions aren't recognized
+		bool isIndexedColumn(QSqlDatabase& Db, const QString& Table, const QString& Column)
+		{
+			QStringList Indexes;
+			{
+				// columns: seq, name, unique, origin, partial
+				QSqlQuery Query(Db);
+				if (!Query.exec(QString("PRAGMA index_list(%1);").arg(Table)))
+					return false;
+				while (Query.next())
+				{
+					Indexes.append(Query.value(1).toString());
+				}
+			}
+			for (const QString& Index : Indexes)
+			{
+				// columns: seqno, cid, name (NULL for expressions)
+				QSqlQuery Query(Db);
+				if (!Query.exec(QString("PRAGMA index_info(\"%1\");").arg(Index)))
+					continue;
+				while (Query.next())
+				{
+					if (Query.value(2).toString().compare(Column, Qt::CaseInsensitive) == 0)
+						return true;
+				}
+			}
+			return false;
+		}
+
+		//! @brief bytes held by the page cache of Db, an upper bound estimate without the SQLite API
+		qint64 measurePageCache(QSqlDatabase& Db)
+		{
+			if (!Db.isOpen())
+				return 0;
+#ifdef PORTABLEDB_USE_SQLITE_API
+			if (sqlite3* pDb = sqliteHandle(Db))
+			{
+				int iCurrent = 0, iHighwater = 0;
+				sqlite3_db_status(pDb, SQLITE_DBSTATUS_CACHE_USED, &iCurrent, &iHighwater, 0);
+				return iCurrent;
+			}
+#endif
+			// the cache can't hold more than the file nor more than cache_size pages
+			QSqlQuery Query(Db);
+			qint64 iPageSize = 0, iPageCount = 0, iCacheSize = 0;
+			if (Query.exec("PRAGMA page_size;") && Query.next())
+				iPageSize = Query.value(0).toLongLong();
+			if (Query.exec("PRAGMA page_count;") && Query.next())
+				iPageCount = Query.value(0).toLongLong();
+			if (Query.exec("PRAGMA cache_size;") && Query.next())
+				iCacheSize = Query.value(0).toLongLong();
+			// negative cache_size is in KiB
+			const qint64 iCacheBytes = iCacheSize < 0 ? -iCacheSize * 1024 : iCacheSize * iPageSize;
+			return std::min(iPageCount * iPageSize, iCacheBytes);
+		}
+
+		qint64 sqliteHeapUsed()
+		{
+#ifdef PORTABLEDB_USE_SQLITE_API
+			return sqlite3_memory_used();
+#else
+			return -1;
+#endif
+		}
+
+		void releaseConnectionMemory(QSqlDatabase& Db)
+		{
+			if (!Db.isOpen())
+				return;
+#ifdef PORTABLEDB_USE_SQLITE_API
+			if (sqlite3* pDb = sqliteHandle(Db))
+			{
+				sqlite3_db_release_memory(pDb);
+				return;
+			}
+#endif
+			QSqlQuery Query(Db);
+			Query.exec("PRAGMA shrink_memory;");
+		}
+
+		void applyPageCacheBudget(QSqlDatabase& Db, qint64 Bytes)
+		{
+			// 0 restores SQLite's default of 2000 KiB
+			const qint64 iKiB = Bytes > 0 ? std::max<qint64>(Bytes / 1024, 64) : 2000;
+			QSqlQuery Query(Db);
+			Query.exec(QString("PRAGMA cache_size = -%1;").arg(iKiB));
+		}
+
+		//! @brief stops the statements running on Db once Options is abandoned, for the lifetime of the guard
+		//! needs PORTABLEDB_USE_SQLITE_API, without it abandoned operations are only dropped before they start
+		class DbInterruptGuard
+		{
+		public:
+			DbInterruptGuard(QSqlDatabase& Db, const DbOperationOptions& Options)
+				: m_Options(Options)
+			{
+#ifdef PORTABLEDB_USE_SQLITE_API
+				if (Options.isInterruptible())
+				{
+					m_pDb = sqliteHandle(Db);
+					if (m_pDb)
+					{
+						sqlite3_progress_handler(m_pDb, 1000, &DbInterruptGuard::onProgress, this);
+					}
+				}
+#else
+				Q_UNUSED(Db);
+#endif
+			}
+
+			~DbInterruptGuard()
+			{
+#ifdef PORTABLEDB_USE_SQLITE_API
+				if (m_pDb)
+				{
+					sqlite3_progress_handler(m_pDb, 0, nullptr, nullptr);
+				}
+#endif
+			}
+
+			bool isInterrupted() const { return m_bInterrupted; }
+
+		private:
+			const DbOperationOptions& m_Options;
+			bool m_bInterrupted = false;
+#ifdef PORTABLEDB_USE_SQLITE_API
+			sqlite3* m_pDb = nullptr;
+
+			//! called every 1000 virtual machine instructions, non-zero fails the statement with SQLITE_INTERRUPT
+			static int onProgress(void* pContext)
+			{
+				DbInterruptGuard* pGuard = static_cast<DbInterruptGuard*>(pContext);
+				DbAbandonReason Reason;
+				if (pGuard->m_Options.isAbandoned(Reason))
+				{
+					pGuard->m_bInterrupted = true;
+					return 1;
+				}
+				return 0;
+			}
+#endif
+		};
+	}
+
+	DbHandlerPrivate::DbHandlerPrivate(DbExecutionModel ExecutionModel)
+		: m_ThreadedDb(ExecutionModel)
+		, m_spColumnCodecs(m_ThreadedDb.columnCodecs())
+		, m_spPartitions(m_ThreadedDb.partitions())
+		, m_spQueryPlanAdvisor(m_ThreadedDb.queryPlanAdvisor())
 	{
 		// m_ThreadedDb had its ctor executed and is thus already running its own thread
+		m_OperationQueue.setConsumerThread(m_ThreadedDb.thread());
+		m_ThreadedDb.setOperationQueue(&m_OperationQueue);
 		initConnections();
 	}
 
 	DbHandlerPrivate::~DbHandlerPrivate()
 	{
 		closeDb();
+		// readers have to be gone before m_ThreadedDb shuts down
+		QMutexLocker Lock(&m_mReadAll);
+		m_Readers.clear();
 	}
 
 	void DbHandlerPrivate::initConnections()
 	{
-		connect(this, &DbHandlerPrivate::threadedSaveToDb, &m_ThreadedDb, &ThreadedDbHandler::onSaveToDb, Qt::QueuedConnection);
-		connect(this, &DbHandlerPrivate::threadedUpdateInDb, &m_ThreadedDb, &ThreadedDbHandler::onUpdateInDb, Qt::QueuedConnection);
-		connect(this, &DbHandlerPrivate::threadedDeleteInDb, &m_ThreadedDb, &ThreadedDbHandler::onDeleteInDb, Qt::QueuedConnection);
-		connect(this, &DbHandlerPrivate::threadedReadFromDb, &m_ThreadedDb, &ThreadedDbHandler::onReadFromDb, Qt::QueuedConnection);
-		connect(this, &DbHandlerPrivate::threadedReadAllFromHandler, &m_ThreadedDb, &ThreadedDbHandler::onReadAllFromHandler, Qt::QueuedConnection);
-		connect(this, &DbHandlerPrivate::threadedDbVersion, &m_ThreadedDb, &ThreadedDbHandler::onDbVersion, Qt::QueuedConnection);
-		connect(this, &DbHandlerPrivate::threadedInitializeDb, &m_ThreadedDb, &ThreadedDbHandler::onInitializeDb, Qt::QueuedConnection);
-		connect(this, &DbHandlerPrivate::threadedCloseDb, &m_ThreadedDb, &ThreadedDbHandler::onCloseDb, Qt::QueuedConnection);
-		connect(this, &DbHandlerPrivate::threadedDeleteAllInDb, &m_ThreadedDb, &ThreadedDbHandler::onDeleteAllInDb, Qt::QueuedConnection);
-		connect(&m_ThreadedDb, &ThreadedDbHandler::DbReady, this, &DbHandlerPrivate::DbReady, Qt::QueuedConnection);
-		connect(&m_ThreadedDb, &ThreadedDbHandler::DbReadAllFinishedForHandler, this, &DbHandlerPrivate::DbReadAllFinishedForHandler);
-		connect(&m_ThreadedDb, &ThreadedDbHandler::DbError, this, &DbHandlerPrivate::DbError, Qt::QueuedConnection);
+		// inline execution has no Db thread, the caller's thread may not even run an event loop
+		const Qt::ConnectionType DbConnection = m_ThreadedDb.executionModel() == DbExecutionModel::Inline ? Qt::DirectConnection : Qt::QueuedConnection;
+		connect(&m_OperationQueue, &DbOperationQueue::operationsAvailable, &m_ThreadedDb, &ThreadedDbHandler::onOperationsAvailable, Qt::QueuedConnection);
+		connect(&m_OperationQueue, &DbOperationQueue::overflow, this, &DbHandlerPrivate::onQueueOverflow, Qt::QueuedConnection);
+		connect(&m_ThreadedDb, &ThreadedDbHandler::DbTemplateDatabaseCreated, this, &DbHandlerPrivate::DbTemplateDatabaseCreated, DbConnection);
+		connect(this, &DbHandlerPrivate::threadedSearchFullText, &m_ThreadedDb, &ThreadedDbHandler::onSearchFullText, DbConnection);
+		connect(&m_ThreadedDb, &ThreadedDbHandler::DbFullTextSearchFinished, this, &DbHandlerPrivate::DbFullTextSearchFinished, DbConnection);
+		connect(this, &DbHandlerPrivate::threadedQueryDiagnostics, &m_ThreadedDb, &ThreadedDbHandler::onQueryDiagnostics, DbConnection);
+		connect(this, &DbHandlerPrivate::threadedRequestQueryPlanReport, &m_ThreadedDb, &ThreadedDbHandler::onRequestQueryPlanReport, DbConnection);
+		connect(&m_ThreadedDb, &ThreadedDbHandler::DbQueryPlanReportReady, this, &DbHandlerPrivate::DbQueryPlanReportReady, DbConnection);
+		connect(&m_ThreadedDb, &ThreadedDbHandler::DbCheckpointFinished, this, &DbHandlerPrivate::DbCheckpointFinished, DbConnection);
+		connect(this, &DbHandlerPrivate::threadedMemoryBudget, &m_ThreadedDb, &ThreadedDbHandler::onMemoryBudget, DbConnection);
+		connect(this, &DbHandlerPrivate::threadedReleaseMemory, &m_ThreadedDb, &ThreadedDbHandler::onReleaseMemory, DbConnection);
+		connect(this, &DbHandlerPrivate::threadedRequestMemoryUsage, &m_ThreadedDb, &ThreadedDbHandler::onRequestMemoryUsage, DbConnection);
+		connect(&m_ThreadedDb, &ThreadedDbHandler::DbMemoryMeasured, this, &DbHandlerPrivate::onDbMemoryMeasured, DbConnection);
+		connect(&m_ThreadedDb, &ThreadedDbHandler::DbReady, this, &DbHandlerPrivate::DbReady, DbConnection);
+		connect(&m_ThreadedDb, &ThreadedDbHandler::DbOpened, this, &DbHandlerPrivate::onDbOpened, DbConnection);
+		connect(&m_ThreadedDb, &ThreadedDbHandler::DbReadAllFinishedForHandler, this, &DbHandlerPrivate::onReadAllFinishedOnDbThread, DbConnection);
+		connect(&m_ThreadedDb, &ThreadedDbHandler::DbError, this, &DbHandlerPrivate::DbError, DbConnection);
+		connect(&m_ThreadedDb, &ThreadedDbHandler::DbOperationAbandoned, this, &DbHandlerPrivate::onOperationAbandoned, DbConnection);
 	}
 
-	void DbHandlerPrivate::AddTable(std::unique_ptr<ITableDefinition> Table)
+	bool DbHandlerPrivate::AddTable(std::unique_ptr<ITableDefinition> Table)
 	{
+		if (!Table)
+			return false;
+		if (!Table->isValid())
+		{
+			emit DbError("table definition rejected, it is invalid (e.g. clashing column names)", DbErrorCode::General);
+			return false;
+		}
+		// compressed values are BLOBs to SQLite, an index or FTS5 table over them would see the compressed bytes
+		const QString sRejected("%1.%2 is full text searched, its column codec is ignored");
+		for (const QString& sColumn : searchedColumns(*Table))
+		{
+			m_SearchedColumns.insert(sColumn);
+			if (m_CodecColumns.erase(sColumn) > 0)
+			{
+				const QStringList Names = sColumn.split('.');
+				m_spColumnCodecs->remove(Names.first(), Names.last());
+				emit DbError(sRejected.arg(Names.first(), Names.last()), DbErrorCode::General);
+			}
+		}
+		for (const DbCodecColumn& Column : Table->codecColumns())
+		{
+			const QString sColumn = Column.Table.toLower() + '.' + Column.Column.toLower();
+			if (m_SearchedColumns.count(sColumn) > 0)
+			{
+				emit DbError(sRejected.arg(Column.Table, Column.Column), DbErrorCode::General);
+				continue;
+			}
+			m_CodecColumns.insert(sColumn);
+			m_spColumnCodecs->add(Column);
+		}
 		m_ThreadedDb.AddTable(std::move(Table));
+		return true;
+	}
+
+	bool DbHandlerPrivate::AddPartitionedTable(const DbTimePartitionedTable& Table)
+	{
+		if (!m_ThreadedDb.AddPartitionedTable(Table))
+		{
+			emit DbError(QString("partitioned table %1 rejected: invalid name or more than %2 partitioned tables")
+				.arg(Table.table()).arg(DbPartitionManager::MaxPartitionedTables), DbErrorCode::General);
+			return false;
+		}
+		return true;
 	}
 
 	void DbHandlerPrivate::setDbVersion(int DbVersion)
 	{
-		emit threadedDbVersion(DbVersion, QPrivateSignal());
+		DbOperation Operation;
+		Operation.Control = DbControlOperation::SetDbVersion;
+		Operation.Value = DbVersion;
+		submitOperation(std::move(Operation));
+	}
+
+	void DbHandlerPrivate::setTemplateDatabase(const QString& TemplateFilename)
+	{
+		DbOperation Operation;
+		Operation.Control = DbControlOperation::SetTemplateDatabase;
+		Operation.Value = TemplateFilename;
+		submitOperation(std::move(Operation));
+	}
+
+	void DbHandlerPrivate::createTemplateDatabase(const QString& TemplateFilename)
+	{
+		DbOperation Operation;
+		Operation.Control = DbControlOperation::CreateTemplateDatabase;
+		Operation.Value = TemplateFilename;
+		submitOperation(std::move(Operation));
 	}
 
 	void DbHandlerPrivate::InitializeDb(const QString & ProposedFilename)
 	{
-		emit threadedInitializeDb(ProposedFilename, QPrivateSignal());
+		DbOperation Operation;
+		Operation.Control = DbControlOperation::InitializeDb;
+		Operation.Value = ProposedFilename;
+		submitOperation(std::move(Operation));
 	}
 
 	void DbHandlerPrivate::DeleteAllData()
 	{
-		emit threadedDeleteAllInDb(QPrivateSignal());
+		DbOperation Operation;
+		Operation.Control = DbControlOperation::DeleteAllData;
+		submitOperation(std::move(Operation));
 	}
 
 	void DbHandlerPrivate::registerHandler(QSharedPointer<DbDataHandlerBase> spHandler)
 	{
 		if (spHandler)
 		{
+			spHandler->m_spColumnCodecs = m_spColumnCodecs;
+			spHandler->m_spPartitions = m_spPartitions;
+			spHandler->m_spQueryPlanAdvisor = m_spQueryPlanAdvisor;
 			QMutexLocker Lock(&m_mHandlerList);
 			m_HandlerMap[spHandler->uuid()] = spHandler;
 		}
@@ -74,52 +328,239 @@ namespace PortableDBBackend
 		return spRet;
 	}
 
-	void DbHandlerPrivate::saveToDb(QUuid handlerUuid, QVariant value)
+	void DbHandlerPrivate::queueOperation(DbOperationType Type, QUuid handlerUuid, const QVariant& Value, const DbOperationOptions& Options)
 	{
-		QSharedPointer<DbDataHandlerBase> spHandler = getHandler(handlerUuid);
-		if (spHandler)
+		if (Type == DbOperationType::ReadAll && handlerUuid.isNull())
 		{
-			emit threadedSaveToDb(spHandler, value, QPrivateSignal());
+			readAllHandlers(Options);
+			return;
+		}
+		DbOperation Operation;
+		Operation.Type = Type;
+		Operation.spHandler = getHandler(handlerUuid);
+		Operation.Value = Value;
+		Operation.Options = Options;
+		if (Operation.spHandler)
+		{
+			submitOperation(std::move(Operation));
 		}
 	}
 
-	void DbHandlerPrivate::updateInDb(QUuid handlerUuid, QVariant value)
+	void DbHandlerPrivate::submitOperation(DbOperation Operation)
 	{
-		QSharedPointer<DbDataHandlerBase> spHandler = getHandler(handlerUuid);
-		if (spHandler)
+		if (m_ThreadedDb.executionModel() == DbExecutionModel::Inline)
 		{
-			emit threadedUpdateInDb(spHandler, value, QPrivateSignal());
+			m_ThreadedDb.executeInline(Operation);
 		}
+		else
+		{
+			// rejections are reported through onQueueOverflow
+			m_OperationQueue.push(std::move(Operation));
+		}
+	}
+
+	void DbHandlerPrivate::saveToDb(QUuid handlerUuid, QVariant value)
+	{
+		queueOperation(DbOperationType::Save, handlerUuid, value);
+	}
+
+	void DbHandlerPrivate::updateInDb(QUuid handlerUuid, QVariant value)
+	{
+		queueOperation(DbOperationType::Update, handlerUuid, value);
 	}
 
 	void DbHandlerPrivate::deleteInDb(QUuid handlerUuid, QVariant value)
 	{
-		QSharedPointer<DbDataHandlerBase> spHandler = getHandler(handlerUuid);
-		if (spHandler)
+		queueOperation(DbOperationType::Delete, handlerUuid, value);
+	}
+
+	void DbHandlerPrivate::readFromDb(QUuid handlerUuid, QVariant value)
+	{
+		queueOperation(DbOperationType::Read, handlerUuid, value);
+	}
+
+	void DbHandlerPrivate::readAllFromHandler(QUuid handlerUuid)
+	{
+		queueOperation(DbOperationType::ReadAll, handlerUuid, QVariant());
+	}
+
+	QUuid DbHandlerPrivate::searchFullText(const QString& FtsTable, const QString& MatchExpression, int Offset, int Limit, const DbOperationOptions& Options)
+	{
+		QUuid SearchId = QUuid::createUuid();
+		emit threadedSearchFullText(SearchId, FtsTable, MatchExpression, Offset, Limit, Options, QPrivateSignal());
+		return SearchId;
+	}
+
+	void DbHandlerPrivate::setQueryDiagnostics(bool bEnabled)
+	{
+		emit threadedQueryDiagnostics(bEnabled, QPrivateSignal());
+	}
+
+	void DbHandlerPrivate::requestQueryPlanReport(const DbOperationOptions& Options)
+	{
+		emit threadedRequestQueryPlanReport(Options, QPrivateSignal());
+	}
+
+	void DbHandlerPrivate::setCheckpointSettings(const DbCheckpointSettings& Settings)
+	{
+		DbOperation Operation;
+		Operation.Control = DbControlOperation::SetCheckpointSettings;
+		Operation.Value = QVariant::fromValue(Settings);
+		submitOperation(std::move(Operation));
+	}
+
+	void DbHandlerPrivate::setQueueLimits(const DbQueueLimits& Limits)
+	{
+		{
+			QMutexLocker Lock(&m_mMemoryBudget);
+			m_QueueLimits = Limits;
+		}
+		bool bPublish = false;
+		{
+			QMutexLocker Lock(&m_mReadAll);
+			bPublish = applyMemoryBudget();
+		}
+		if (bPublish)
 		{
-			emit threadedDeleteInDb(spHandler, value, QPrivateSignal());
+			publishMemoryBudget();
 		}
 	}
 
-	void DbHandlerPrivate::readFromDb(QUuid handlerUuid, QVariant value)
+	void DbHandlerPrivate::setMemoryBudget(qint64 Bytes)
 	{
-		QSharedPointer<DbDataHandlerBase> spHandler = getHandler(handlerUuid);
-		if (spHandler)
 		{
-			emit threadedReadFromDb(spHandler, value, QPrivateSignal());
+			QMutexLocker Lock(&m_mMemoryBudget);
+			m_iMemoryBudget = std::max<qint64>(0, Bytes);
+		}
+		bool bPublish = false;
+		{
+			QMutexLocker Lock(&m_mReadAll);
+			bPublish = applyMemoryBudget();
+		}
+		if (bPublish)
+		{
+			publishMemoryBudget();
 		}
 	}
 
-	void DbHandlerPrivate::readAllFromHandler(QUuid handlerUuid)
+	bool DbHandlerPrivate::applyMemoryBudget()
 	{
-		QSharedPointer<DbDataHandlerBase> spHandler = getHandler(handlerUuid);
-		if (spHandler)
+		QMutexLocker Lock(&m_mMemoryBudget);
+		const qint64 iBudget = m_iMemoryBudget;
+		DbQueueLimits Limits = m_QueueLimits;
+
+		qint64 iMainCache = 0, iReaderCache = 0, iSoftHeapLimit = 0;
+		if (iBudget > 0)
+		{
+			iMainCache = iBudget / 2;
+			iReaderCache = m_Readers.empty() ? 0 : (iBudget / 5) / static_cast<qint64>(m_Readers.size());
+			// SQLite gets the caches plus 10% for statements and other allocations
+			iSoftHeapLimit = iMainCache + iReaderCache * static_cast<qint64>(m_Readers.size()) + iBudget / 10;
+			const qint64 iQueueShare = iBudget / 5;
+			if (Limits.MaxBytes <= 0 || Limits.MaxBytes > iQueueShare)
+				Limits.MaxBytes = iQueueShare;
+		}
+		m_OperationQueue.setLimits(Limits);
+		// without a budget the caches keep the SQLite defaults, only lifting a budget resets them
+		if (iBudget <= 0 && !m_bBudgetApplied)
+			return false;
+		m_bBudgetApplied = iBudget > 0;
+		for (auto& spReader : m_Readers)
+		{
+			spReader->setPageCacheBudget(iReaderCache);
+		}
+		m_iMainCacheShare = iMainCache;
+		m_iSoftHeapLimitShare = iSoftHeapLimit;
+		return true;
+	}
+
+	void DbHandlerPrivate::publishMemoryBudget()
+	{
+		qint64 iMainCache = 0, iSoftHeapLimit = 0;
+		{
+			QMutexLocker Lock(&m_mMemoryBudget);
+			iMainCache = m_iMainCacheShare;
+			iSoftHeapLimit = m_iSoftHeapLimitShare;
+		}
+		// emitted unlocked: inline execution runs onMemoryBudget and the receivers of its DbMemoryMeasured right away
+		emit threadedMemoryBudget(iMainCache, iSoftHeapLimit, QPrivateSignal());
+	}
+
+	void DbHandlerPrivate::releaseMemory()
+	{
+		emit threadedReleaseMemory(QPrivateSignal());
+		// readers release their memory after every read anyway, see ThreadedDbReader::onReadAllFromHandler
+	}
+
+	void DbHandlerPrivate::requestMemoryUsage()
+	{
+		emit threadedRequestMemoryUsage(QPrivateSignal());
+	}
+
+	void DbHandlerPrivate::setWriteBatchSize(int OperationsPerTransaction)
+	{
+		DbOperation Operation;
+		Operation.Control = DbControlOperation::SetWriteBatchSize;
+		Operation.Value = std::max(0, OperationsPerTransaction);
+		submitOperation(std::move(Operation));
+	}
+
+	void DbHandlerPrivate::onDbMemoryMeasured(qint64 PageCacheBytes, qint64 SqliteHeapBytes, bool /*bReleased*/)
+	{
+		DbMemoryUsage Usage;
+		Usage.PageCacheMain = PageCacheBytes;
+		Usage.SqliteHeap = SqliteHeapBytes;
+		Usage.OperationQueue = m_OperationQueue.statistics().Bytes;
+		{
+			QMutexLocker Lock(&m_mReadAll);
+			for (auto& spReader : m_Readers)
+			{
+				Usage.PageCacheReaders += spReader->pageCacheUsed();
+			}
+		}
+		{
+			QMutexLocker Lock(&m_mMemoryBudget);
+			Usage.Budget = m_iMemoryBudget;
+		}
+		emit DbMemoryUsageReport(Usage);
+	}
+
+	DbQueueStatistics DbHandlerPrivate::queueStatistics() const
+	{
+		return m_OperationQueue.statistics();
+	}
+
+	QList<DbCodecStatistics> DbHandlerPrivate::codecStatistics() const
+	{
+		return m_spColumnCodecs->statistics();
+	}
+
+	void DbHandlerPrivate::onQueueOverflow(DbQueueOverflowPolicy Policy, DbOperationType Type, QUuid handlerUuid, quint64 ReadAllRequest)
+	{
+		if (Policy == DbQueueOverflowPolicy::Reject || Policy == DbQueueOverflowPolicy::DropOldest)
+		{
+			emit DbError(QString("operation queue full, operation for handler %1 discarded").arg(handlerUuid.toString()), DbErrorCode::QueueFull);
+		}
+		if (Type == DbOperationType::ReadAll)
 		{
-			emit threadedReadAllFromHandler(spHandler, QPrivateSignal());
+			// the operation will never be executed, a running readAll must not wait for it
+			readAllHandlerFinished(handlerUuid, ReadAllRequest);
 		}
+		emit DbQueueOverflow(Policy, Type, handlerUuid);
+	}
+
+	void DbHandlerPrivate::onOperationAbandoned(DbOperationType Type, QUuid handlerUuid, DbAbandonReason Reason)
+	{
+		m_OperationQueue.recordAbandoned(Reason);
+		emit DbOperationAbandoned(Type, handlerUuid, Reason);
 	}
 
 	void DbHandlerPrivate::readAll()
+	{
+		readAllHandlers(DbOperationOptions());
+	}
+
+	void DbHandlerPrivate::readAllHandlers(const DbOperationOptions& Options)
 	{
 		// I rather want to create a copy of all QtSharedPointer
 		std::vector<QSharedPointer<DbDataHandlerBase>> handlerList;
@@ -131,23 +572,383 @@ namespace PortableDBBackend
 			}
 		}
 		// leave scope to release QMutex
-		for (auto& spHandler : handlerList)
+		if (handlerList.empty())
+		{
+			emit DbReadAllFinished();
+			return;
+		}
+		bool bUseReaders = false;
+		quint64 ReadAllRequest = 0;
 		{
-			emit threadedReadAllFromHandler(spHandler, QPrivateSignal());
+			QMutexLocker Lock(&m_mReadAll);
+			// overlapping readAll() calls and readAllFromHandler calls of the same handlers finish independently
+			ReadAllRequest = ++m_iLastReadAllRequest;
+			std::multiset<QUuid>& Pending = m_PendingReadAll[ReadAllRequest];
+			for (auto& spHandler : handlerList)
+			{
+				Pending.insert(spHandler->uuid());
+			}
+			// readers need an initialized Db file, until then everything is serialized on the Db thread
+			bUseReaders = !m_Readers.empty() && !m_DbFilename.isEmpty();
+			if (bUseReaders)
+			{
+				for (auto& spHandler : handlerList)
+				{
+					DbOperation Operation;
+					Operation.Type = DbOperationType::ReadAll;
+					Operation.spHandler = spHandler;
+					Operation.Options = Options;
+					Operation.ReadAllRequest = ReadAllRequest;
+					m_ReadAllQueue.push_back(std::move(Operation));
+				}
+				dispatchReadAll();
+			}
+		}
+		if (!bUseReaders)
+		{
+			for (auto& spHandler : handlerList)
+			{
+				DbOperation Operation;
+				Operation.Type = DbOperationType::ReadAll;
+				Operation.spHandler = spHandler;
+				Operation.Options = Options;
+				Operation.ReadAllRequest = ReadAllRequest;
+				submitOperation(std::move(Operation));
+			}
+		}
+	}
+
+	void DbHandlerPrivate::setReadAllConcurrency(int MaxParallelReads)
+	{
+		bool bPublish = false;
+		{
+			QMutexLocker Lock(&m_mReadAll);
+			m_iRequestedReaders = std::max(0, MaxParallelReads);
+			if (m_PendingReadAll.empty())
+			{
+				bPublish = applyReadAllConcurrency();
+			}
+		}
+		if (bPublish)
+		{
+			publishMemoryBudget();
+		}
+	}
+
+	bool DbHandlerPrivate::applyReadAllConcurrency()
+	{
+		if (static_cast<int>(m_Readers.size()) == m_iRequestedReaders)
+			return false;
+
+		m_Readers.clear(); // every reader waits for its thread to finish
+		m_ReaderBusy.assign(m_iRequestedReaders, false);
+		for (int i = 0; i < m_iRequestedReaders; i++)
+		{
+			auto spReader = std::make_unique<ThreadedDbReader>(i, m_spPartitions);
+			connect(this, &DbHandlerPrivate::threadedOpenReaders, spReader.get(), &ThreadedDbReader::onOpenDb, Qt::QueuedConnection);
+			connect(this, &DbHandlerPrivate::threadedCloseReaders, spReader.get(), &ThreadedDbReader::onCloseDb, Qt::QueuedConnection);
+			connect(spReader.get(), &ThreadedDbReader::ReadAllFinished, this, &DbHandlerPrivate::onReadAllFinishedOnReader, Qt::QueuedConnection);
+			connect(spReader.get(), &ThreadedDbReader::DbError, this, &DbHandlerPrivate::DbError, Qt::QueuedConnection);
+			connect(spReader.get(), &ThreadedDbReader::DbOperationAbandoned, this, &DbHandlerPrivate::onOperationAbandoned, Qt::QueuedConnection);
+			m_Readers.push_back(std::move(spReader));
+		}
+		const bool bPublish = applyMemoryBudget();
+		if (!m_DbFilename.isEmpty())
+		{
+			emit threadedOpenReaders(m_DbFilename, QPrivateSignal());
+		}
+		return bPublish;
+	}
+
+	void DbHandlerPrivate::dispatchReadAll()
+	{
+		for (size_t i = 0; i < m_Readers.size() && !m_ReadAllQueue.empty(); i++)
+		{
+			if (!m_ReaderBusy[i])
+			{
+				ThreadedDbReader* pReader = m_Readers[i].get();
+				DbOperation Operation = std::move(m_ReadAllQueue.front());
+				m_ReadAllQueue.pop_front();
+				m_ReaderBusy[i] = true;
+				QMetaObject::invokeMethod(pReader, [pReader, Operation]() { pReader->onReadAllFromHandler(Operation.spHandler, Operation.ReadAllRequest, Operation.Options); }, Qt::QueuedConnection);
+			}
+		}
+	}
+
+	void DbHandlerPrivate::onDbOpened(const QString& DbFilename)
+	{
+		QMutexLocker Lock(&m_mReadAll);
+		m_DbFilename = DbFilename;
+		if (!m_Readers.empty())
+		{
+			emit threadedOpenReaders(m_DbFilename, QPrivateSignal());
+		}
+	}
+
+	void DbHandlerPrivate::onReadAllFinishedOnDbThread(QUuid handlerUuid, quint64 ReadAllRequest)
+	{
+		emit DbReadAllFinishedForHandler(handlerUuid);
+		readAllHandlerFinished(handlerUuid, ReadAllRequest);
+	}
+
+	void DbHandlerPrivate::onReadAllFinishedOnReader(int ReaderIndex, QUuid handlerUuid, quint64 ReadAllRequest)
+	{
+		{
+			QMutexLocker Lock(&m_mReadAll);
+			if (ReaderIndex >= 0 && ReaderIndex < static_cast<int>(m_ReaderBusy.size()))
+			{
+				m_ReaderBusy[ReaderIndex] = false;
+			}
+			dispatchReadAll();
+		}
+		emit DbReadAllFinishedForHandler(handlerUuid);
+		readAllHandlerFinished(handlerUuid, ReadAllRequest);
+	}
+
+	void DbHandlerPrivate::readAllHandlerFinished(QUuid handlerUuid, quint64 ReadAllRequest)
+	{
+		if (ReadAllRequest == 0)
+			return; // a single readAllFromHandler call, not part of readAll
+		bool bAllFinished = false;
+		bool bPublish = false;
+		{
+			QMutexLocker Lock(&m_mReadAll);
+			auto RequestIt = m_PendingReadAll.find(ReadAllRequest);
+			if (RequestIt == m_PendingReadAll.end())
+				return;
+			auto It = RequestIt->second.find(handlerUuid);
+			if (It == RequestIt->second.end())
+				return;
+			RequestIt->second.erase(It);
+			bAllFinished = RequestIt->second.empty();
+			if (bAllFinished)
+			{
+				m_PendingReadAll.erase(RequestIt);
+			}
+			if (m_PendingReadAll.empty())
+			{
+				// a concurrency change requested during the readAll can be applied now
+				bPublish = applyReadAllConcurrency();
+			}
+		}
+		if (bPublish)
+		{
+			publishMemoryBudget();
+		}
+		// emit without holding the lock, receivers may well trigger the next readAll
+		if (bAllFinished)
+		{
+			emit DbReadAllFinished();
 		}
 	}
 
 	void DbHandlerPrivate::closeDb()
 	{
-		emit threadedCloseDb(QPrivateSignal());
+		{
+			QMutexLocker Lock(&m_mReadAll);
+			m_DbFilename.clear();
+		}
+		emit threadedCloseReaders(QPrivateSignal());
+		DbOperation Operation;
+		Operation.Control = DbControlOperation::CloseDb;
+		submitOperation(std::move(Operation));
+	}
+
+	/**********************************************************
+	*	ThreadedDbReader
+	***********************************************************/
+	ThreadedDbReader::ThreadedDbReader(int ReaderIndex, std::shared_ptr<DbPartitionManager> spPartitions)
+		: m_iReaderIndex(ReaderIndex)
+		, m_ConnectionName(QString("PortableDbReader_%1_%2").arg(reinterpret_cast<quintptr>(this)).arg(ReaderIndex))
+		, m_spPartitions(spPartitions)
+	{
+		initializeThread();
+	}
+
+	ThreadedDbReader::~ThreadedDbReader()
+	{
+		finishThread();
+	}
+
+	void ThreadedDbReader::onOpenDb(const QString& DbFilename)
+	{
+		onCloseDb();
+		// the connection itself is opened on first use
+		m_DbFilename = DbFilename;
+	}
+
+	void ThreadedDbReader::onCloseDb()
+	{
+		m_DbFilename.clear();
+		m_iPageCacheUsed = 0;
+		if (m_Db.isValid())
+		{
+			m_Db.close();
+			// closed first: retired files we had attached can be deleted now
+			m_spPartitions->connectionClosed(m_ConnectionName);
+			m_Db = QSqlDatabase();
+			QSqlDatabase::removeDatabase(m_ConnectionName);
+		}
+	}
+
+	bool ThreadedDbReader::openConnection()
+	{
+		if (m_Db.isOpen())
+			return true;
+		if (m_DbFilename.isEmpty())
+			return false;
+
+		m_Db = QSqlDatabase::addDatabase("QSQLITE", m_ConnectionName);
+		// the Db thread keeps writing while we read, so wait for its locks instead of failing right away
+		m_Db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+		m_Db.setDatabaseName(m_DbFilename);
+		if (!m_Db.open())
+		{
+			emit DbError(QString("read connection %1 failed: %2").arg(m_iReaderIndex).arg(m_Db.lastError().text()), DbErrorCode::General);
+			return false;
+		}
+		QSqlQuery Query(m_Db);
+		Query.exec("PRAGMA foreign_keys = ON;");
+		Query.exec("PRAGMA recursive_triggers = ON;");
+		m_iAppliedPageCacheBudget = 0;
+		return true;
+	}
+
+	void ThreadedDbReader::setPageCacheBudget(qint64 Bytes)
+	{
+		m_iPageCacheBudget = Bytes;
+	}
+
+	qint64 ThreadedDbReader::pageCacheUsed() const
+	{
+		return m_iPageCacheUsed;
+	}
+
+	void ThreadedDbReader::onReadAllFromHandler(QSharedPointer<DbDataHandlerBase> spHandler, quint64 ReadAllRequest, const DbOperationOptions& Options)
+	{
+		if (!spHandler)
+			return;
+
+		DbAbandonReason Reason;
+		if (Options.isAbandoned(Reason))
+		{
+			emit DbOperationAbandoned(DbOperationType::ReadAll, spHandler->uuid(), Reason);
+		}
+		else if (openConnection())
+		{
+			const qint64 iBudget = m_iPageCacheBudget;
+			if (iBudget != m_iAppliedPageCacheBudget)
+			{
+				applyPageCacheBudget(m_Db, iBudget);
+				m_iAppliedPageCacheBudget = iBudget;
+			}
+			bool bInterrupted = false;
+			{
+				DbInterruptGuard Guard(m_Db, Options);
+				spHandler->readAll(m_Db);
+				bInterrupted = Guard.isInterrupted();
+			}
+			if (bInterrupted)
+			{
+				emit DbOperationAbandoned(DbOperationType::ReadAll, spHandler->uuid(), DbAbandonReason::Interrupted);
+			}
+			if (iBudget > 0)
+			{
+				// readAll is a one time hydration, the cached pages are of little use afterwards
+				releaseConnectionMemory(m_Db);
+			}
+			m_iPageCacheUsed = measurePageCache(m_Db);
+		}
+		// report even on failure, otherwise DbReadAllFinished would never be emitted
+		emit ReadAllFinished(m_iReaderIndex, spHandler->uuid(), ReadAllRequest);
+	}
+
+	void ThreadedDbReader::onShutDown()
+	{
+		onCloseDb();
+		m_ReaderThread.quit();
+	}
+
+	void ThreadedDbReader::finishThread()
+	{
+		// same as ThreadedDbHandler: let the queued reads finish before the thread quits
+		emit shutdownDbReader(QPrivateSignal());
+		m_ReaderThread.wait();
+	}
+
+	void ThreadedDbReader::initializeThread()
+	{
+		moveToThread(&m_ReaderThread);
+		connect(this, &ThreadedDbReader::shutdownDbReader, this, &ThreadedDbReader::onShutDown, Qt::QueuedConnection);
+		m_ReaderThread.start();
+	}
+
+	/**********************************************************
+	*	DbSharedExecutor
+	***********************************************************/
+	DbSharedExecutor& DbSharedExecutor::instance()
+	{
+		static DbSharedExecutor Executor;
+		return Executor;
+	}
+
+	DbSharedExecutor::~DbSharedExecutor()
+	{
+		for (auto& spThread : m_Threads)
+		{
+			spThread->quit();
+			spThread->wait();
+		}
+	}
+
+	void DbSharedExecutor::setThreadCount(int ThreadCount)
+	{
+		QMutexLocker Lock(&m_mThreads);
+		m_iThreadCount = std::max(1, ThreadCount);
+	}
+
+	QThread* DbSharedExecutor::acquireThread()
+	{
+		QMutexLocker Lock(&m_mThreads);
+		if (static_cast<int>(m_Threads.size()) < m_iThreadCount)
+		{
+			// start threads lazily, an unused pool costs nothing
+			m_Threads.push_back(std::make_unique<QThread>());
+			m_Threads.back()->setObjectName(QString("PortableDbExecutor_%1").arg(m_Threads.size()));
+			m_Threads.back()->start();
+			m_ThreadUsers.push_back(0);
+		}
+		auto LeastUsed = std::min_element(m_ThreadUsers.begin(), m_ThreadUsers.end());
+		(*LeastUsed)++;
+		return m_Threads[std::distance(m_ThreadUsers.begin(), LeastUsed)].get();
+	}
+
+	void DbSharedExecutor::releaseThread(QThread* pThread)
+	{
+		QMutexLocker Lock(&m_mThreads);
+		for (size_t i = 0; i < m_Threads.size(); i++)
+		{
+			if (m_Threads[i].get() == pThread)
+			{
+				m_ThreadUsers[i]--;
+				break;
+			}
+		}
 	}
 
 	/**********************************************************
 	*	ThreadedDbHandler
 	***********************************************************/
-	ThreadedDbHandler::ThreadedDbHandler()
+	ThreadedDbHandler::ThreadedDbHandler(DbExecutionModel ExecutionModel)
+		: m_ExecutionModel(ExecutionModel)
+		, m_pOwnerThread(QThread::currentThread())
 	{
+		initializeThread();
+	}
 
+	DbExecutionModel ThreadedDbHandler::executionModel() const
+	{
+		return m_ExecutionModel;
 	}
 
 	ThreadedDbHandler::~ThreadedDbHandler()
@@ -158,9 +959,255 @@ namespace PortableDBBackend
 	void ThreadedDbHandler::AddTable(std::unique_ptr<ITableDefinition> Table)
 	{
 		QMutexLocker Lock(&m_mDatabaseDefinition);
+		if (const DbFtsTableDefinition* pFts = dynamic_cast<const DbFtsTableDefinition*>(Table.get()))
+		{
+			m_FtsTables.insert(pFts->ftsTable().toLower());
+		}
 		m_DbManager.AddTable(std::move(Table));
 	}
 
+	bool ThreadedDbHandler::AddPartitionedTable(const DbTimePartitionedTable& Table)
+	{
+		QMutexLocker Lock(&m_mDatabaseDefinition);
+		return m_DbManager.AddPartitionedTable(Table);
+	}
+
+	std::shared_ptr<DbColumnCodecs> ThreadedDbHandler::columnCodecs() const
+	{
+		return m_spColumnCodecs;
+	}
+
+	void ThreadedDbHandler::removeIndexedCodecs()
+	{
+		// compressed values are BLOBs to SQLite, an index over them would compare the compressed bytes
+		for (const DbCodecStatistics& Column : m_spColumnCodecs->statistics())
+		{
+			if (isIndexedColumn(m_Db, Column.Table, Column.Column))
+			{
+				m_spColumnCodecs->remove(Column.Table, Column.Column);
+				emit DbError(QString("%1.%2 is indexed, its column codec is ignored").arg(Column.Table, Column.Column), DbErrorCode::General);
+			}
+		}
+	}
+
+	std::shared_ptr<DbPartitionManager> ThreadedDbHandler::partitions() const
+	{
+		return m_DbManager.Partitions();
+	}
+
+	std::shared_ptr<DbQueryPlanAdvisor> ThreadedDbHandler::queryPlanAdvisor() const
+	{
+		return m_spQueryPlanAdvisor;
+	}
+
+	void ThreadedDbHandler::setOperationQueue(DbOperationQueue* pQueue)
+	{
+		m_pOperationQueue = pQueue;
+	}
+
+	void ThreadedDbHandler::onOperationsAvailable()
+	{
+		if (!m_pOperationQueue)
+			return;
+
+		// handlers keep their own DbTransaction scopes, within a batch they become savepoints
+		std::unique_ptr<DbTransaction> spBatch;
+		std::vector<DbOperation> Batched; //!< executed within spBatch, run again one by one if its commit fails
+		DbOperation Operation;
+		while (m_pOperationQueue->pop(Operation))
+		{
+			const bool bWrite = Operation.Control == DbControlOperation::None && Operation.Type != DbOperationType::Read && Operation.Type != DbOperationType::ReadAll;
+			if (bWrite && m_iWriteBatchSize > 0 && !spBatch && m_Db.isOpen())
+			{
+				spBatch = std::make_unique<DbTransaction>(m_Db, DbTransactionMode::Immediate);
+			}
+			else if (spBatch && (Operation.Control != DbControlOperation::None || (!bWrite && m_DbManager.Partitions()->hasTables())))
+			{
+				// control operations close or replace the connection, reads may have to ATTACH partitions,
+				// neither is possible within a transaction
+				commitBatch(*spBatch, Batched);
+				spBatch.reset();
+			}
+			// requests left by operations outside of batches (e.g. within an own DbTransaction) would rerun this one
+			m_DbManager.Partitions()->takeAttachRequest(m_Db.connectionName());
+			if (!spBatch || !bWrite)
+			{
+				executeOperation(Operation);
+				continue;
+			}
+			// a savepoint per batched operation, so an operation which needs a partition attached can be undone on its own
+			DbTransaction OperationScope(m_Db);
+			executeOperation(Operation);
+			if (m_DbManager.Partitions()->takeAttachRequest(m_Db.connectionName()))
+			{
+				// see DbDataHandlerBase::partitionForWrite, the operation may have written before it asked
+				if (!OperationScope.rollback() || !OperationScope.isRolledBack())
+				{
+					emit DbError(QString("rolling back an operation which needs a partition attached failed, it isn't run again: %1")
+						.arg(OperationScope.lastError().text()), DbErrorCode::General);
+					continue;
+				}
+				commitBatch(*spBatch, Batched);
+				spBatch.reset();
+				executeOperation(Operation);
+			}
+			else
+			{
+				OperationScope.commit();
+				Batched.push_back(Operation);
+				if (static_cast<int>(Batched.size()) >= m_iWriteBatchSize)
+				{
+					commitBatch(*spBatch, Batched);
+					spBatch.reset();
+				}
+			}
+		}
+		if (spBatch)
+		{
+			commitBatch(*spBatch, Batched);
+		}
+		scheduleCheckpoint();
+		releaseMemoryUnderPressure();
+	}
+
+	void ThreadedDbHandler::commitBatch(DbTransaction& Batch, std::vector<DbOperation>& Operations)
+	{
+		if (Batch.isActive() && !Batch.commit())
+		{
+			if (!Batch.isRolledBack())
+			{
+				// e.g. a handler committed the batch itself, running the operations again would apply them twice
+				emit DbError(QString("committing a batch of %1 operations failed, they may be partly applied: %2")
+					.arg(Operations.size()).arg(Batch.lastError().text()), DbErrorCode::General);
+				Operations.clear();
+				return;
+			}
+			emit DbError(QString("committing a batch of %1 operations failed, running them one by one: %2")
+				.arg(Operations.size()).arg(Batch.lastError().text()), DbErrorCode::General);
+			// without the batch every operation commits (and fails) on its own, handlers report their errors,
+			// operations cancelled or expired by now are reported with DbOperationAbandoned by executeOperation
+			for (const DbOperation& Operation : Operations)
+			{
+				executeOperation(Operation);
+			}
+		}
+		Operations.clear();
+	}
+
+	void ThreadedDbHandler::onWriteBatchSize(int OperationsPerTransaction)
+	{
+		m_iWriteBatchSize = OperationsPerTransaction;
+	}
+
+	void ThreadedDbHandler::executeInline(const DbOperation& Operation)
+	{
+		if (!executeOperation(Operation))
+			return;
+		scheduleCheckpoint();
+		releaseMemoryUnderPressure();
+	}
+
+	bool ThreadedDbHandler::checkThread()
+	{
+		// Qt Sql connections may only be used by the thread that opened them, for inline execution that is our creator
+		if (QThread::currentThread() == thread())
+			return true;
+		emit DbError("DbExecutionModel::Inline DbHandler used from another thread than its creator, call ignored", DbErrorCode::General);
+		return false;
+	}
+
+	bool ThreadedDbHandler::executeOperation(const DbOperation& Operation)
+	{
+		if (!checkThread())
+		{
+			if (Operation.Control == DbControlOperation::None && Operation.Type == DbOperationType::ReadAll)
+			{
+				// a running readAll() must not wait for it
+				emit DbReadAllFinishedForHandler(Operation.spHandler->uuid(), Operation.ReadAllRequest);
+			}
+			return false;
+		}
+		switch (Operation.Control)
+		{
+		case DbControlOperation::InitializeDb:
+			onInitializeDb(Operation.Value.toString());
+			return true;
+		case DbControlOperation::CloseDb:
+			onCloseDb();
+			return true;
+		case DbControlOperation::DeleteAllData:
+			onDeleteAllInDb();
+			return true;
+		case DbControlOperation::SetDbVersion:
+			onDbVersion(Operation.Value.toInt());
+			return true;
+		case DbControlOperation::SetTemplateDatabase:
+			onTemplateDatabase(Operation.Value.toString());
+			return true;
+		case DbControlOperation::CreateTemplateDatabase:
+			onCreateTemplateDatabase(Operation.Value.toString());
+			return true;
+		case DbControlOperation::SetCheckpointSettings:
+			onCheckpointSettings(Operation.Value.value<DbCheckpointSettings>());
+			return true;
+		case DbControlOperation::SetWriteBatchSize:
+			onWriteBatchSize(Operation.Value.toInt());
+			return true;
+		case DbControlOperation::None:
+			break;
+		}
+
+		DbAbandonReason Reason;
+		if (Operation.Options.isAbandoned(Reason))
+		{
+			emit DbOperationAbandoned(Operation.Type, Operation.spHandler->uuid(), Reason);
+			if (Operation.Type == DbOperationType::ReadAll)
+			{
+				// a running readAll() must not wait for it
+				emit DbReadAllFinishedForHandler(Operation.spHandler->uuid(), Operation.ReadAllRequest);
+			}
+			return true;
+		}
+		if (Operation.Type == DbOperationType::Read || Operation.Type == DbOperationType::ReadAll)
+		{
+			bool bInterrupted = false;
+			{
+				DbInterruptGuard Guard(m_Db, Operation.Options);
+				if (Operation.Type == DbOperationType::Read)
+				{
+					onReadFromDb(Operation.spHandler, Operation.Value);
+				}
+				else
+				{
+					onReadAllFromHandler(Operation.spHandler, Operation.ReadAllRequest);
+				}
+				bInterrupted = Guard.isInterrupted();
+			}
+			if (bInterrupted)
+			{
+				emit DbOperationAbandoned(Operation.Type, Operation.spHandler->uuid(), DbAbandonReason::Interrupted);
+			}
+			return true;
+		}
+
+		m_bCheckpointPending = true;
+		switch (Operation.Type)
+		{
+		case DbOperationType::Save:
+			onSaveToDb(Operation.spHandler, Operation.Value);
+			break;
+		case DbOperationType::Update:
+			onUpdateInDb(Operation.spHandler, Operation.Value);
+			break;
+		case DbOperationType::Delete:
+			onDeleteInDb(Operation.spHandler, Operation.Value);
+			break;
+		default:
+			break;
+		}
+		return true;
+	}
+
 	void ThreadedDbHandler::onSaveToDb(QSharedPointer<DbDataHandlerBase> spHandler, QVariant Value)
 	{
 		if (spHandler)
@@ -193,18 +1240,20 @@ namespace PortableDBBackend
 		}
 	}
 
-	void ThreadedDbHandler::onReadAllFromHandler(QSharedPointer<DbDataHandlerBase> spHandler)
+	void ThreadedDbHandler::onReadAllFromHandler(QSharedPointer<DbDataHandlerBase> spHandler, quint64 ReadAllRequest)
 	{
 		if (spHandler)
 		{
 			spHandler->readAll(m_Db);
-			emit DbReadAllFinishedForHandler(spHandler->uuid());
+			emit DbReadAllFinishedForHandler(spHandler->uuid(), ReadAllRequest);
 		}
 	}
 
 	void ThreadedDbHandler::onDeleteAllInDb()
 	{
 		m_DbManager.DeleteAllData(m_Db);
+		m_bCheckpointPending = true;
+		scheduleCheckpoint();
 	}
 
 	void ThreadedDbHandler::onDbVersion(int DbVersion)
@@ -213,18 +1262,240 @@ namespace PortableDBBackend
 		m_DbManager.setDbVersion(DbVersion);
 	}
 
+	void ThreadedDbHandler::onTemplateDatabase(const QString& TemplateFilename)
+	{
+		QMutexLocker Lock(&m_mDatabaseDefinition);
+		m_DbManager.setTemplateDatabase(TemplateFilename);
+	}
+
+	void ThreadedDbHandler::onCreateTemplateDatabase(const QString& TemplateFilename)
+	{
+		bool bSuccess = false;
+		if (checkThread())
+		{
+			QMutexLocker Lock(&m_mDatabaseDefinition);
+			bSuccess = m_DbManager.CreateTemplateDatabase(TemplateFilename);
+		}
+		emit DbTemplateDatabaseCreated(TemplateFilename, bSuccess);
+	}
+
+	void ThreadedDbHandler::onSearchFullText(QUuid SearchId, const QString& FtsTable, const QString& MatchExpression, int Offset, int Limit, const DbOperationOptions& Options)
+	{
+		DbAbandonReason Reason;
+		if (!checkThread() || Options.isAbandoned(Reason))
+		{
+			// the caller gave up on it, no DbError
+			emit DbFullTextSearchFinished(SearchId, DbRowSet());
+			return;
+		}
+
+		bool bKnownTable = false;
+		{
+			QMutexLocker Lock(&m_mDatabaseDefinition);
+			bKnownTable = m_FtsTables.count(FtsTable.toLower()) > 0;
+		}
+		if (!bKnownTable)
+		{
+			// the name ends up in the SQL text, only tables we created ourselves are accepted
+			emit DbError(QString("full text search on %1 failed: not a table declared with DbFtsTableDefinition").arg(FtsTable), DbErrorCode::General);
+			emit DbFullTextSearchFinished(SearchId, DbRowSet());
+			return;
+		}
+
+		QVariantList BindValues;
+		BindValues << MatchExpression << Limit << Offset;
+		const QString sSearchSql = DbFtsTableDefinition::searchSql(FtsTable);
+		QElapsedTimer Timer;
+		Timer.start();
+		DbRowSet Result;
+		bool bInterrupted = false;
+		{
+			DbInterruptGuard Guard(m_Db, Options);
+			Result = DbRowSet::fromSql(m_Db, sSearchSql, BindValues);
+			bInterrupted = Guard.isInterrupted();
+		}
+		// the trace hook sees it anyway
+		if (!m_spQueryPlanAdvisor->tracesConnection(m_Db.connectionName()))
+		{
+			m_spQueryPlanAdvisor->record(sSearchSql, Timer.nsecsElapsed());
+		}
+		if (!Result.isValid() && !bInterrupted)
+		{
+			emit DbError(QString("full text search on %1 failed: %2").arg(FtsTable, Result.errorString()), DbErrorCode::General);
+		}
+		// reported even on failure, callers wait for their SearchId
+		emit DbFullTextSearchFinished(SearchId, Result);
+	}
+
+	void ThreadedDbHandler::onQueryDiagnostics(bool bEnabled)
+	{
+		if (!checkThread())
+			return;
+		m_spQueryPlanAdvisor->setEnabled(bEnabled);
+		if (!bEnabled)
+		{
+			m_spQueryPlanAdvisor->detach();
+			m_spQueryPlanAdvisor->clear();
+		}
+		else if (m_Db.isOpen())
+		{
+			m_spQueryPlanAdvisor->attach(m_Db);
+		}
+	}
+
+	void ThreadedDbHandler::onRequestQueryPlanReport(const DbOperationOptions& Options)
+	{
+		DbQueryPlanReport Report;
+		if (checkThread() && m_Db.isOpen())
+		{
+			DbInterruptGuard Guard(m_Db, Options);
+			Report = m_spQueryPlanAdvisor->createReport(m_Db, [&Options]() { DbAbandonReason Reason; return Options.isAbandoned(Reason); });
+		}
+		emit DbQueryPlanReportReady(Report);
+	}
+
+	void ThreadedDbHandler::onCheckpointSettings(const DbCheckpointSettings& Settings)
+	{
+		if (!checkThread())
+			return;
+		m_CheckpointScheduler.setSettings(Settings);
+		if (m_Db.isOpen() && !m_CheckpointScheduler.configure(m_Db))
+		{
+			emit DbError("WAL checkpoint scheduling not available for this database", DbErrorCode::General);
+		}
+		if (!Settings.bEnabled && m_pCheckpointTimer)
+		{
+			m_pCheckpointTimer->stop();
+		}
+	}
+
+	void ThreadedDbHandler::scheduleCheckpoint()
+	{
+		if (!m_CheckpointScheduler.settings().bEnabled || !m_bCheckpointPending || !m_Db.isOpen())
+			return;
+
+		if (m_CheckpointScheduler.checkpointOverdue(m_Db))
+		{
+			// the queue may never become idle, don't let the WAL grow without bounds
+			runCheckpoint(m_CheckpointScheduler.modeForWalSize(DbCheckpointScheduler::walSize(m_Db)));
+			return;
+		}
+		if (m_ExecutionModel == DbExecutionModel::Inline)
+		{
+			// inline callers may not run an event loop: no idle timer, checkpoint as soon as the budget is exceeded
+			const DbCheckpointMode Mode = m_CheckpointScheduler.modeForWalSize(DbCheckpointScheduler::walSize(m_Db));
+			if (Mode != DbCheckpointMode::Passive)
+			{
+				runCheckpoint(Mode);
+			}
+			return;
+		}
+		if (!m_pCheckpointTimer)
+		{
+			m_pCheckpointTimer = new QTimer(this);
+			m_pCheckpointTimer->setSingleShot(true);
+			connect(m_pCheckpointTimer, &QTimer::timeout, this, &ThreadedDbHandler::onCheckpointTimer);
+		}
+		// every batch of writes postpones the checkpoint until the queue was quiet for IdleMilliseconds
+		m_pCheckpointTimer->start(m_CheckpointScheduler.settings().IdleMilliseconds);
+	}
+
+	void ThreadedDbHandler::onCheckpointTimer()
+	{
+		if (!m_bCheckpointPending || !m_Db.isOpen())
+			return;
+		if (m_pOperationQueue && m_pOperationQueue->statistics().Depth > 0)
+			return; // not idle after all, the drain reschedules us
+		runCheckpoint(m_CheckpointScheduler.modeForWalSize(DbCheckpointScheduler::walSize(m_Db)));
+	}
+
+	void ThreadedDbHandler::runCheckpoint(DbCheckpointMode Mode)
+	{
+		DbCheckpointStatistics Statistics = m_CheckpointScheduler.checkpoint(m_Db, Mode);
+		// a busy checkpoint stays pending and is retried after the next writes
+		m_bCheckpointPending = Statistics.bBusy;
+		emit DbCheckpointFinished(Statistics);
+	}
+
+	void ThreadedDbHandler::onMemoryBudget(qint64 PageCacheBytes, qint64 SoftHeapLimit)
+	{
+		if (!checkThread())
+			return;
+		m_iPageCacheBudget = PageCacheBytes;
+		m_iSoftHeapLimit = SoftHeapLimit;
+		applyMemoryBudget();
+	}
+
+	void ThreadedDbHandler::applyMemoryBudget()
+	{
+		if (!m_Db.isOpen())
+			return; // applied by onInitializeDb
+		applyPageCacheBudget(m_Db, m_iPageCacheBudget);
+		// process wide, the last DbHandler setting a budget wins
+		QSqlQuery Query(m_Db);
+		Query.exec(QString("PRAGMA soft_heap_limit = %1;").arg(m_iSoftHeapLimit));
+	}
+
+	void ThreadedDbHandler::onReleaseMemory()
+	{
+		if (!checkThread())
+			return;
+		releaseConnectionMemory(m_Db);
+		emit DbMemoryMeasured(measurePageCache(m_Db), sqliteHeapUsed(), true);
+	}
+
+	void ThreadedDbHandler::onRequestMemoryUsage()
+	{
+		if (!checkThread())
+			return;
+		emit DbMemoryMeasured(measurePageCache(m_Db), sqliteHeapUsed(), false);
+	}
+
+	void ThreadedDbHandler::releaseMemoryUnderPressure()
+	{
+		if (m_iSoftHeapLimit <= 0)
+			return;
+		// only measurable with the SQLite API, otherwise cache_size and the soft heap limit have to do
+		if (sqliteHeapUsed() <= m_iSoftHeapLimit)
+			return;
+		releaseConnectionMemory(m_Db);
+		emit DbMemoryMeasured(measurePageCache(m_Db), sqliteHeapUsed(), true);
+	}
+
 	void ThreadedDbHandler::onInitializeDb(const QString & ProposedFilename)
 	{
 		QMutexLocker Lock(&m_mDatabaseDefinition);
 		if (m_DbManager.InitializeDB(ProposedFilename, m_Db))
 		{
+			// after RunUpdates, which may have added indexes
+			removeIndexedCodecs();
+			if (m_spQueryPlanAdvisor->isEnabled())
+			{
+				m_spQueryPlanAdvisor->attach(m_Db);
+			}
+			if (m_iPageCacheBudget > 0)
+			{
+				applyMemoryBudget();
+			}
+			if (m_CheckpointScheduler.settings().bEnabled && !m_CheckpointScheduler.configure(m_Db))
+			{
+				emit DbError("WAL checkpoint scheduling not available for this database", DbErrorCode::General);
+			}
+			emit DbOpened(m_Db.databaseName());
 			emit DbReady();
 		}
 	}
 
 	void ThreadedDbHandler::onCloseDb()
 	{
+		if (m_pCheckpointTimer)
+		{
+			m_pCheckpointTimer->stop();
+		}
+		m_bCheckpointPending = false;
+		m_spQueryPlanAdvisor->detach();
 		m_Db.close();
+		m_DbManager.Partitions()->connectionClosed(m_Db.connectionName());
 	}
 
 	void ThreadedDbHandler::onShutDown()
@@ -237,8 +1508,34 @@ namespace PortableDBBackend
 		// nothing yet :)
 	}
 
+	void ThreadedDbHandler::onDetachFromExecutor()
+	{
+		// runs in the shared thread: only the current thread may push an object to another thread
+		moveToThread(m_pOwnerThread);
+	}
+
 	void ThreadedDbHandler::finishThread()
 	{
+		if (m_ExecutionModel == DbExecutionModel::Inline)
+			return; // there is no thread to finish
+
+		if (m_ExecutionModel == DbExecutionModel::SharedExecutor)
+		{
+			// the thread keeps running for the other handlers, we only leave it once our queued events were processed
+			QThread* pSharedThread = thread();
+			if (pSharedThread == QThread::currentThread())
+			{
+				// destroyed from within the pool, e.g. by another handler: waiting for ourselves would dead lock
+				onDetachFromExecutor();
+			}
+			else
+			{
+				QMetaObject::invokeMethod(this, &ThreadedDbHandler::onDetachFromExecutor, Qt::BlockingQueuedConnection);
+			}
+			DbSharedExecutor::instance().releaseThread(pSharedThread);
+			return;
+		}
+
 		// we signal our shutdown event in order to still execute other events still in the queue
 		// which would be disregarded on m_DbThread.quit()
 		emit shutdownDbHandler(QPrivateSignal());
@@ -251,6 +1548,17 @@ namespace PortableDBBackend
 
 	void ThreadedDbHandler::initializeThread()
 	{
+		if (m_ExecutionModel == DbExecutionModel::Inline)
+			return; // everything runs on the calling thread
+
+		if (m_ExecutionModel == DbExecutionModel::SharedExecutor)
+		{
+			moveToThread(DbSharedExecutor::instance().acquireThread());
+			connect(this, &ThreadedDbHandler::threadedInit, this, &ThreadedDbHandler::onThreadedInit, Qt::QueuedConnection);
+			emit threadedInit(QPrivateSignal());
+			return;
+		}
+
 		moveToThread(&m_DbThread);
 		// make some vital connections
 		connect(this, &ThreadedDbHandler::threadedInit, this, &ThreadedDbHandler::onThreadedInit, Qt::QueuedConnection);
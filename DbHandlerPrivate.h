@@ -1,33 +1,85 @@
 #pragma once
 #include "DbHandler.h"
+#include "DbOperationQueue.h"
 #include "databackend.h"
 
 #include <QMutex>
 #include <QThread>
+#include <QTimer>
+
+#include <atomic>
+#include <deque>
+#include <set>
 
 namespace PortableDBBackend
 {
+	//! @brief DbSharedExecutor owns the thread pool for DbExecutionModel::SharedExecutor
+	//! every ThreadedDbHandler is bound to the least used thread for its whole lifetime
+	class DbSharedExecutor
+	{
+	public:
+		static DbSharedExecutor& instance();
+		~DbSharedExecutor();
+
+		void setThreadCount(int ThreadCount);
+		QThread* acquireThread();
+		void releaseThread(QThread* pThread);
+
+	private:
+		DbSharedExecutor() = default;
+
+		QMutex m_mThreads; //!< protects all members below
+		int m_iThreadCount = 2;
+		std::vector<std::unique_ptr<QThread>> m_Threads;
+		std::vector<int> m_ThreadUsers;
+	};
+
 	//! @brief ThreadedDbHandler runs all its slots in its own thread and is the only class with access to the database
+	//! the thread is either private, taken from DbSharedExecutor or, for DbExecutionModel::Inline, the thread that created us
 	class ThreadedDbHandler : public QObject
 	{
 		Q_OBJECT
 	public:
-		ThreadedDbHandler();
+		explicit ThreadedDbHandler(DbExecutionModel ExecutionModel);
 		virtual ~ThreadedDbHandler();
 
+		DbExecutionModel executionModel() const;
+
 		//! add definition for database tables
 		//! unfortunately the unique_ptr design prevents us from using signal/slot queued connections
 		//! thus we will directly call the embedded ThreadedDbHandler in which AddTable is secured by a mutex
 		void AddTable(std::unique_ptr<ITableDefinition> Table);
+		bool AddPartitionedTable(const DbTimePartitionedTable& Table);
+		//! @brief thread safe and constant for our lifetime
+		std::shared_ptr<DbColumnCodecs> columnCodecs() const;
+		std::shared_ptr<DbPartitionManager> partitions() const;
+		std::shared_ptr<DbQueryPlanAdvisor> queryPlanAdvisor() const;
+
+		//! handler operations are taken from this queue, it must outlive the ThreadedDbHandler
+		void setOperationQueue(DbOperationQueue* pQueue);
+
+		//! @brief DbExecutionModel::Inline: runs Operation right away, calls from another thread than our creator are skipped with DbError
+		void executeInline(const DbOperation& Operation);
 
 	public slots:
+		void onOperationsAvailable(); //!< drains the operation queue
 		void onSaveToDb(QSharedPointer<DbDataHandlerBase> spHandler, QVariant Value);
 		void onUpdateInDb(QSharedPointer<DbDataHandlerBase> spHandler, QVariant Value);
 		void onDeleteInDb(QSharedPointer<DbDataHandlerBase> spHandler, QVariant Value);
 		void onReadFromDb(QSharedPointer<DbDataHandlerBase> spHandler, QVariant Value);
-		void onReadAllFromHandler(QSharedPointer<DbDataHandlerBase> spHandler);
+		void onReadAllFromHandler(QSharedPointer<DbDataHandlerBase> spHandler, quint64 ReadAllRequest);
 		void onDeleteAllInDb();
 		void onDbVersion(int DbVersion);
+		void onTemplateDatabase(const QString& TemplateFilename);
+		void onCreateTemplateDatabase(const QString& TemplateFilename);
+		void onSearchFullText(QUuid SearchId, const QString& FtsTable, const QString& MatchExpression, int Offset, int Limit, const DbOperationOptions& Options);
+		void onQueryDiagnostics(bool bEnabled);
+		void onRequestQueryPlanReport(const DbOperationOptions& Options);
+		void onCheckpointSettings(const DbCheckpointSettings& Settings);
+		void onMemoryBudget(qint64 PageCacheBytes, qint64 SoftHeapLimit);
+		void onWriteBatchSize(int OperationsPerTransaction);
+		void onReleaseMemory();
+		void onRequestMemoryUsage();
 		void onInitializeDb(const QString& ProposedFilename);
 		void onCloseDb();
 
@@ -36,41 +88,122 @@ namespace PortableDBBackend
 		void threadedInit(QPrivateSignal);
 		void shutdownDbHandler(QPrivateSignal);
 		void DbReady();
-		void DbReadAllFinishedForHandler(QUuid handlerUuid);
+		void DbTemplateDatabaseCreated(const QString& TemplateFilename, bool bSuccess);
+		void DbOpened(const QString& DbFilename); //!< emitted together with DbReady, carries the file used for additional read connections
+		void DbReadAllFinishedForHandler(QUuid handlerUuid, quint64 ReadAllRequest); //!< see DbOperation::ReadAllRequest
+		void DbFullTextSearchFinished(QUuid SearchId, const DbRowSet& Result);
+		void DbQueryPlanReportReady(const DbQueryPlanReport& Report);
+		void DbCheckpointFinished(const DbCheckpointStatistics& Statistics);
+		void DbMemoryMeasured(qint64 PageCacheBytes, qint64 SqliteHeapBytes, bool bReleased);
+		void DbOperationAbandoned(DbOperationType Type, QUuid handlerUuid, DbAbandonReason Reason);
 
 	private slots:
 		void onThreadedInit();
 		void onShutDown();
+		void onDetachFromExecutor();
+		void onCheckpointTimer();
 
 	private:
+		const DbExecutionModel m_ExecutionModel;
+		QThread* m_pOwnerThread; //!< thread that created us, shared executor threads hand us back on shutdown
 		QMutex m_mDatabaseDefinition; //!< protect/serialize m_DbManager calls
 		DataBackend m_DbManager;
-		QSqlDatabase m_Db;
+		std::set<QString> m_FtsTables; //!< lower case names of the DbFtsTableDefinition tables, guarded by m_mDatabaseDefinition
+		QSqlDatabase m_Db; //!< declared after m_DbManager: released before DataBackend removes the connection
 		QThread m_DbThread;
+		DbOperationQueue* m_pOperationQueue = nullptr;
+		std::shared_ptr<DbQueryPlanAdvisor> m_spQueryPlanAdvisor = std::make_shared<DbQueryPlanAdvisor>(); //!< shared with handlers, see DbDataHandlerBase::execQuery
+		std::shared_ptr<DbColumnCodecs> m_spColumnCodecs = std::make_shared<DbColumnCodecs>(); //!< filled by DbHandlerPrivate::AddTable, shared with handlers
+		DbCheckpointScheduler m_CheckpointScheduler;
+		QTimer* m_pCheckpointTimer = nullptr; //!< created on first use, in the thread running our slots
+		bool m_bCheckpointPending = false; //!< writes happened since the last checkpoint
+		qint64 m_iPageCacheBudget = 0; //!< 0: SQLite default cache_size
+		qint64 m_iSoftHeapLimit = 0;
+		int m_iWriteBatchSize = 0; //!< 0: no batching, see DbHandler::setWriteBatchSize
 
+		//! @brief false if the operation was skipped, see checkThread
+		bool executeOperation(const DbOperation& Operation);
+		//! @brief m_Db is only used by our own thread (no lock needed), false and DbError for inline callers on other threads
+		bool checkThread();
+		void removeIndexedCodecs(); //!< drops the codecs of columns covered by an index of the opened m_Db
+		//! @brief a failed commit rolls Batch back, Operations are then run again without a batch so each one succeeds or fails on its own
+		void commitBatch(DbTransaction& Batch, std::vector<DbOperation>& Operations);
+		void scheduleCheckpoint(); //!< (re)starts the idle timer after writes, checkpoints at once if the WAL is overdue
+		void runCheckpoint(DbCheckpointMode Mode);
+		void applyMemoryBudget();
+		void releaseMemoryUnderPressure(); //!< after a batch: shrink if SQLite exceeds its soft heap limit
 		void finishThread(); //!< called from d'tor in main thread, initiate shutdown and wait until thread is terminated
 		void initializeThread();//!< called from ctor in main thread, will move this QObject to its own thread
 
 	};
 
+	//! @brief ThreadedDbReader owns an additional read-only connection to the database file and runs in its own thread
+	//! DbHandlerPrivate uses a set of readers to run readAll of several handlers in parallel
+	class ThreadedDbReader : public QObject
+	{
+		Q_OBJECT
+	public:
+		//! @param spPartitions partitions are attached to our connection on demand, see DbDataHandlerBase::forEachPartition
+		ThreadedDbReader(int ReaderIndex, std::shared_ptr<DbPartitionManager> spPartitions);
+		virtual ~ThreadedDbReader();
+
+		//! @brief page cache limit, applied before the next read, thread safe
+		void setPageCacheBudget(qint64 Bytes);
+		//! @brief page cache in use after the last read, thread safe
+		qint64 pageCacheUsed() const;
+
+	public slots:
+		void onOpenDb(const QString& DbFilename);
+		void onCloseDb();
+		void onReadAllFromHandler(QSharedPointer<DbDataHandlerBase> spHandler, quint64 ReadAllRequest, const DbOperationOptions& Options);
+
+	signals:
+		void DbError(const QString& ErrorDsc, DbErrorCode ErrorCode);
+		void ReadAllFinished(int ReaderIndex, QUuid handlerUuid, quint64 ReadAllRequest); //!< also for abandoned reads
+		void DbOperationAbandoned(DbOperationType Type, QUuid handlerUuid, DbAbandonReason Reason);
+		void shutdownDbReader(QPrivateSignal);
+
+	private slots:
+		void onShutDown();
+
+	private:
+		int m_iReaderIndex;
+		QString m_ConnectionName; //!< every reader needs its own named Qt Sql connection
+		std::shared_ptr<DbPartitionManager> m_spPartitions;
+		QString m_DbFilename;
+		QSqlDatabase m_Db;
+		QThread m_ReaderThread;
+		std::atomic<qint64> m_iPageCacheBudget{ 0 };
+		std::atomic<qint64> m_iPageCacheUsed{ 0 };
+		qint64 m_iAppliedPageCacheBudget = 0; //!< reader thread only
+
+		bool openConnection(); //!< lazily opens m_Db in the reader thread
+		void finishThread(); //!< called from d'tor in main thread, initiate shutdown and wait until thread is terminated
+		void initializeThread(); //!< called from ctor in main thread, will move this QObject to its own thread
+	};
+
 	//! @brief DbHandlerPrivate contains the ThreadedDbHandler 
 	//! and uses QueuedConnections to communicate
 	class DbHandlerPrivate : public QObject
 	{
 		Q_OBJECT
 	public:
-		DbHandlerPrivate();
+		explicit DbHandlerPrivate(DbExecutionModel ExecutionModel);
 		virtual ~DbHandlerPrivate();
 
 		// Database definition
 		//! add definition for database tables
 		//! unfortunately the unique_ptr design prevents us from using signal/slot queued connections
 		//! thus we will directly call the embedded ThreadedDbHandler in which AddTable is secured by a mutex
-		void AddTable(std::unique_ptr<ITableDefinition> Table);
+		bool AddTable(std::unique_ptr<ITableDefinition> Table);
+		bool AddPartitionedTable(const DbTimePartitionedTable& Table);
 
 		//! set the current Db schema version
 		void setDbVersion(int DbVersion);
 
+		void setTemplateDatabase(const QString& TemplateFilename);
+		void createTemplateDatabase(const QString& TemplateFilename);
+
 		void InitializeDb(const QString& ProposedFilename);
 		void DeleteAllData();
 
@@ -79,6 +212,30 @@ namespace PortableDBBackend
 		//! @brief will return nullptr for unknown Uuids
 		QSharedPointer<DbDataHandlerBase> getHandler(QUuid handlerUuid);
 
+		void queueOperation(DbOperationType Type, QUuid handlerUuid, const QVariant& Value, const DbOperationOptions& Options = DbOperationOptions());
+
+		//! @brief number of ThreadedDbReader used by readAll, 0 keeps everything on the Db thread
+		//! changes are deferred until a running readAll has finished
+		void setReadAllConcurrency(int MaxParallelReads);
+
+		void setQueueLimits(const DbQueueLimits& Limits);
+		DbQueueStatistics queueStatistics() const;
+		QList<DbCodecStatistics> codecStatistics() const;
+
+		QUuid searchFullText(const QString& FtsTable, const QString& MatchExpression, int Offset, int Limit, const DbOperationOptions& Options);
+
+		void setQueryDiagnostics(bool bEnabled);
+		void requestQueryPlanReport(const DbOperationOptions& Options);
+		void readAllHandlers(const DbOperationOptions& Options);
+
+		void setCheckpointSettings(const DbCheckpointSettings& Settings);
+
+		void setMemoryBudget(qint64 Bytes);
+		void releaseMemory();
+		void requestMemoryUsage();
+
+		void setWriteBatchSize(int OperationsPerTransaction);
+
 	public slots:
 		void saveToDb(QUuid handlerUuid, QVariant value);
 		void updateInDb(QUuid handlerUuid, QVariant value);
@@ -91,26 +248,74 @@ namespace PortableDBBackend
 	signals:
 		void DbError(const QString& ErrorDsc, DbErrorCode ErrorCode);
 		void DbReady();
+		void DbTemplateDatabaseCreated(const QString& TemplateFilename, bool bSuccess);
 		void DbReadAllFinishedForHandler(QUuid handlerUuid);
+		void DbReadAllFinished();
+		void DbQueueOverflow(DbQueueOverflowPolicy Policy, DbOperationType Type, QUuid handlerUuid);
+		void DbOperationAbandoned(DbOperationType Type, QUuid handlerUuid, DbAbandonReason Reason);
+		void DbFullTextSearchFinished(QUuid SearchId, const DbRowSet& Result);
+		void DbQueryPlanReportReady(const DbQueryPlanReport& Report);
+		void DbCheckpointFinished(const DbCheckpointStatistics& Statistics);
+		void DbMemoryUsageReport(const DbMemoryUsage& Usage);
 
 
 		// signals to communicate with ThreadedDb (using QueuedConnections)
-		void threadedSaveToDb(QSharedPointer<DbDataHandlerBase> spHandler, QVariant Value, QPrivateSignal);
-		void threadedUpdateInDb(QSharedPointer<DbDataHandlerBase> spHandler, QVariant Value, QPrivateSignal);
-		void threadedDeleteInDb(QSharedPointer<DbDataHandlerBase> spHandler, QVariant Value, QPrivateSignal);
-		void threadedReadFromDb(QSharedPointer<DbDataHandlerBase> spHandler, QVariant Value, QPrivateSignal);
-		void threadedReadAllFromHandler(QSharedPointer<DbDataHandlerBase> spHandler, QPrivateSignal);
-		void threadedDbVersion(int DbSchemaVersion, QPrivateSignal);
-		void threadedInitializeDb(const QString& ProposedFilename, QPrivateSignal);
-		void threadedCloseDb(QPrivateSignal);
-		void threadedDeleteAllInDb(QPrivateSignal);
+		// handler operations, the lifecycle calls and the settings they depend on are passed through m_OperationQueue instead, in the caller's order
+		void threadedQueryDiagnostics(bool bEnabled, QPrivateSignal);
+		void threadedMemoryBudget(qint64 PageCacheBytes, qint64 SoftHeapLimit, QPrivateSignal);
+		void threadedReleaseMemory(QPrivateSignal);
+		void threadedRequestMemoryUsage(QPrivateSignal);
+		void threadedRequestQueryPlanReport(const DbOperationOptions& Options, QPrivateSignal);
+		void threadedSearchFullText(QUuid SearchId, const QString& FtsTable, const QString& MatchExpression, int Offset, int Limit, const DbOperationOptions& Options, QPrivateSignal);
+		void threadedOpenReaders(const QString& DbFilename, QPrivateSignal);
+		void threadedCloseReaders(QPrivateSignal);
+
+	private slots:
+		void onDbOpened(const QString& DbFilename);
+		void onReadAllFinishedOnDbThread(QUuid handlerUuid, quint64 ReadAllRequest);
+		void onReadAllFinishedOnReader(int ReaderIndex, QUuid handlerUuid, quint64 ReadAllRequest);
+		void onQueueOverflow(DbQueueOverflowPolicy Policy, DbOperationType Type, QUuid handlerUuid, quint64 ReadAllRequest);
+		void onDbMemoryMeasured(qint64 PageCacheBytes, qint64 SqliteHeapBytes, bool bReleased);
+		void onOperationAbandoned(DbOperationType Type, QUuid handlerUuid, DbAbandonReason Reason);
 
 	private:
+		DbOperationQueue m_OperationQueue; //!< declared before m_ThreadedDb which uses it until its thread is finished
 		ThreadedDbHandler m_ThreadedDb;
 		QMutex m_mHandlerList;
 		std::map<QUuid, QSharedPointer<DbDataHandlerBase> > m_HandlerMap;
+		std::shared_ptr<DbColumnCodecs> m_spColumnCodecs; //!< owned by m_ThreadedDb, filled by AddTable, shared with every registered handler
+		std::set<QString> m_CodecColumns; //!< "table.column" in lower case, only touched by AddTable
+		std::set<QString> m_SearchedColumns; //!< FTS columns, they can't have a codec, only touched by AddTable
+		std::shared_ptr<DbPartitionManager> m_spPartitions; //!< owned by the DataBackend of m_ThreadedDb, shared with handlers and readers
+		std::shared_ptr<DbQueryPlanAdvisor> m_spQueryPlanAdvisor; //!< owned by m_ThreadedDb, shared with handlers
+
+		// parallel readAll
+		QMutex m_mReadAll; //!< protects all members below
+		QString m_DbFilename; //!< empty as long as the Db isn't ready, readAll then falls back to the Db thread
+		std::vector<std::unique_ptr<ThreadedDbReader>> m_Readers;
+		std::vector<bool> m_ReaderBusy;
+		std::deque<DbOperation> m_ReadAllQueue; //!< ReadAll operations waiting for an idle reader
+		std::map<quint64, std::multiset<QUuid>> m_PendingReadAll; //!< per readAll() request: handlers that haven't finished yet
+		quint64 m_iLastReadAllRequest = 0;
+		int m_iRequestedReaders = 0;
+
+		// memory budget
+		QMutex m_mMemoryBudget; //!< protects the members below, lock order: m_mReadAll before m_mMemoryBudget
+		qint64 m_iMemoryBudget = 0;
+		DbQueueLimits m_QueueLimits; //!< as set by the user, the budget may lower MaxBytes
+		bool m_bBudgetApplied = false; //!< the connections run with budget sized caches
+		qint64 m_iMainCacheShare = 0; //!< share of the Db thread connection, see publishMemoryBudget
+		qint64 m_iSoftHeapLimitShare = 0;
 
 		void initConnections(); //!< called from ctor to create all the needed connections
+		void submitOperation(DbOperation Operation); //!< queues Operation or runs it inline
+		bool applyReadAllConcurrency(); //!< (re)creates m_Readers, m_mReadAll must be locked and no reader may be busy, see applyMemoryBudget for the result
+		//! @brief distributes m_iMemoryBudget to the queue and the readers, m_mReadAll must be locked
+		//! @return true if the Db thread connection has to be updated by publishMemoryBudget once m_mReadAll is released
+		bool applyMemoryBudget();
+		void publishMemoryBudget(); //!< hands the Db thread share to m_ThreadedDb, no lock may be held
+		void dispatchReadAll(); //!< hands queued handlers to idle readers, m_mReadAll must be locked
+		void readAllHandlerFinished(QUuid handlerUuid, quint64 ReadAllRequest); //!< bookkeeping for DbReadAllFinished
 	};
 
 }
\ No newline at end of file
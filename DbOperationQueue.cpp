@@ -0,0 +1,264 @@
+#include "DbOperationQueue.h"
+
+#include <QThread>
+
+#include <algorithm>
+#include <utility>
+
+namespace PortableDBBackend
+{
+	DbOperationQueue::DbOperationQueue()
+	{
+	}
+
+	DbOperationQueue::~DbOperationQueue()
+	{
+	}
+
+	void DbOperationQueue::setLimits(const DbQueueLimits& Limits)
+	{
+		QMutexLocker Lock(&m_mQueue);
+		m_Limits = Limits;
+		// a larger capacity may unblock waiting producers
+		m_NotFull.wakeAll();
+	}
+
+	DbQueueLimits DbOperationQueue::limits() const
+	{
+		QMutexLocker Lock(&m_mQueue);
+		return m_Limits;
+	}
+
+	void DbOperationQueue::setConsumerThread(QThread* pConsumerThread)
+	{
+		QMutexLocker Lock(&m_mQueue);
+		m_pConsumerThread = pConsumerThread;
+	}
+
+	bool DbOperationQueue::push(DbOperation Operation)
+	{
+		if (Operation.Control != DbControlOperation::None)
+			return pushControl(std::move(Operation));
+		if (!Operation.spHandler)
+			return false;
+
+		Operation.iBytes = estimateBytes(Operation.Value);
+		Operation.CoalesceKey = Operation.spHandler->coalesceKey(Operation.Type, Operation.Value);
+
+		// overflow reports are collected and emitted after the lock is released
+		const QUuid handlerUuid = Operation.spHandler->uuid();
+		const DbOperationType Type = Operation.Type;
+		const quint64 ReadAllRequest = Operation.ReadAllRequest;
+		std::vector<DbOperation> DroppedOperations;
+		DbQueueOverflowPolicy Policy = DbQueueOverflowPolicy::BlockProducer;
+		bool bRejected = false;
+		bool bCoalesced = false;
+		bool bNotify = false;
+		{
+			QMutexLocker Lock(&m_mQueue);
+			Policy = m_Limits.Policy;
+			if (!fits(Operation.iBytes))
+			{
+				switch (Policy)
+				{
+				case DbQueueOverflowPolicy::BlockProducer:
+					if (QThread::currentThread() != m_pConsumerThread)
+					{
+						m_Statistics.Blocked++;
+						while (!fits(Operation.iBytes))
+						{
+							m_NotFull.wait(&m_mQueue);
+						}
+					}
+					// the consumer can't wait for itself, it exceeds the limit instead
+					break;
+				case DbQueueOverflowPolicy::Reject:
+					bRejected = true;
+					break;
+				case DbQueueOverflowPolicy::DropOldest:
+					while (!fits(Operation.iBytes))
+					{
+						// control operations stay, dropping them would change what the remaining operations apply to
+						auto It = std::find_if(m_Queue.begin(), m_Queue.end(), [](const DbOperation& Queued) { return Queued.Control == DbControlOperation::None; });
+						if (It == m_Queue.end())
+							break;
+						m_Statistics.Bytes -= It->iBytes;
+						DroppedOperations.push_back(std::move(*It));
+						m_Queue.erase(It);
+						m_Statistics.Dropped++;
+					}
+					break;
+				case DbQueueOverflowPolicy::Coalesce:
+					bCoalesced = coalesce(Operation);
+					bRejected = !bCoalesced;
+					break;
+				}
+			}
+			if (bRejected)
+			{
+				m_Statistics.Rejected++;
+			}
+			else if (!bCoalesced)
+			{
+				m_Statistics.Bytes += Operation.iBytes;
+				m_Queue.push_back(std::move(Operation));
+				m_Statistics.Enqueued++;
+				m_Statistics.PeakDepth = std::max(m_Statistics.PeakDepth, static_cast<int>(m_Queue.size()));
+				m_Statistics.PeakBytes = std::max(m_Statistics.PeakBytes, m_Statistics.Bytes);
+				if (!m_bConsumerNotified)
+				{
+					m_bConsumerNotified = true;
+					bNotify = true;
+				}
+			}
+		}
+
+		for (const DbOperation& Dropped : DroppedOperations)
+		{
+			emit overflow(DbQueueOverflowPolicy::DropOldest, Dropped.Type, Dropped.spHandler->uuid(), Dropped.ReadAllRequest);
+		}
+		if (bRejected || bCoalesced)
+		{
+			emit overflow(Policy, Type, handlerUuid, ReadAllRequest);
+		}
+		if (bNotify)
+		{
+			emit operationsAvailable();
+		}
+		return !bRejected;
+	}
+
+	bool DbOperationQueue::pushControl(DbOperation Operation)
+	{
+		bool bNotify = false;
+		{
+			QMutexLocker Lock(&m_mQueue);
+			m_Queue.push_back(std::move(Operation));
+			if (!m_bConsumerNotified)
+			{
+				m_bConsumerNotified = true;
+				bNotify = true;
+			}
+		}
+		if (bNotify)
+		{
+			emit operationsAvailable();
+		}
+		return true;
+	}
+
+	bool DbOperationQueue::pop(DbOperation& Operation)
+	{
+		QMutexLocker Lock(&m_mQueue);
+		if (m_Queue.empty())
+		{
+			// the next push has to notify the consumer again
+			m_bConsumerNotified = false;
+			return false;
+		}
+		Operation = std::move(m_Queue.front());
+		m_Queue.pop_front();
+		m_Statistics.Bytes -= Operation.iBytes;
+		if (Operation.Control == DbControlOperation::None)
+		{
+			m_Statistics.Executed++;
+		}
+		m_NotFull.wakeAll();
+		return true;
+	}
+
+	DbQueueStatistics DbOperationQueue::statistics() const
+	{
+		QMutexLocker Lock(&m_mQueue);
+		DbQueueStatistics Ret = m_Statistics;
+		Ret.Depth = static_cast<int>(m_Queue.size());
+		return Ret;
+	}
+
+	void DbOperationQueue::recordAbandoned(DbAbandonReason Reason)
+	{
+		QMutexLocker Lock(&m_mQueue);
+		switch (Reason)
+		{
+		case DbAbandonReason::Expired:
+			m_Statistics.Expired++;
+			break;
+		case DbAbandonReason::Cancelled:
+			m_Statistics.Cancelled++;
+			break;
+		case DbAbandonReason::Interrupted:
+			m_Statistics.Interrupted++;
+			break;
+		}
+	}
+
+	qint64 DbOperationQueue::estimateBytes(const QVariant& Value)
+	{
+		qint64 iBytes = sizeof(QVariant);
+		switch (Value.userType())
+		{
+		case QMetaType::QByteArray:
+			iBytes += Value.toByteArray().size();
+			break;
+		case QMetaType::QString:
+			iBytes += Value.toString().size() * static_cast<qint64>(sizeof(QChar));
+			break;
+		case QMetaType::QVariantList:
+			for (const QVariant& Element : Value.toList())
+			{
+				iBytes += estimateBytes(Element);
+			}
+			break;
+		case QMetaType::QVariantMap:
+		{
+			const QVariantMap Map = Value.toMap();
+			for (auto It = Map.cbegin(); It != Map.cend(); It++)
+			{
+				iBytes += It.key().size() * static_cast<qint64>(sizeof(QChar)) + estimateBytes(It.value());
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		return iBytes;
+	}
+
+	bool DbOperationQueue::fits(qint64 iBytes) const
+	{
+		if (m_Queue.empty())
+			return true; // never refuse the first operation, else oversized operations could not be executed at all
+		if (m_Limits.MaxOperations > 0 && static_cast<int>(m_Queue.size()) >= m_Limits.MaxOperations)
+			return false;
+		if (m_Limits.MaxBytes > 0 && m_Statistics.Bytes + iBytes > m_Limits.MaxBytes)
+			return false;
+		return true;
+	}
+
+	bool DbOperationQueue::coalesce(DbOperation& Operation)
+	{
+		if (!Operation.CoalesceKey.isValid())
+			return false;
+
+		// the newest matching entry is replaced, it keeps its queue position
+		for (auto It = m_Queue.rbegin(); It != m_Queue.rend(); It++)
+		{
+			// merging across a control operation would move the value to the other side of e.g. DeleteAllData
+			if (It->Control != DbControlOperation::None)
+				return false;
+			if (It->spHandler != Operation.spHandler || It->CoalesceKey != Operation.CoalesceKey)
+				continue;
+			// e.g. save, delete, save of one key: merging the saves would delete the row in the end
+			if (It->Type != Operation.Type)
+				return false;
+			m_Statistics.Bytes += Operation.iBytes - It->iBytes;
+			It->Value = std::move(Operation.Value);
+			// deadline and cancellation belong to the new request
+			It->Options = std::move(Operation.Options);
+			It->iBytes = Operation.iBytes;
+			m_Statistics.Coalesced++;
+			return true;
+		}
+		return false;
+	}
+}
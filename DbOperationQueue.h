@@ -0,0 +1,87 @@
+#pragma once
+#include "DbHandler.h"
+
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <deque>
+
+class QThread;
+
+namespace PortableDBBackend
+{
+	//! @brief calls on the database itself and its configuration, queued with the handler operations so they keep the caller's order
+	//! (e.g. save A, DeleteAllData, save B must never apply B before the delete, setDbVersion must reach InitializeDb first)
+	enum class DbControlOperation
+	{
+		None, //!< a handler operation
+		InitializeDb, //!< Value: proposed file name
+		CloseDb,
+		DeleteAllData,
+		SetDbVersion, //!< Value: int
+		SetTemplateDatabase, //!< Value: template file name
+		CreateTemplateDatabase, //!< Value: template file name
+		SetCheckpointSettings, //!< Value: DbCheckpointSettings
+		SetWriteBatchSize //!< Value: int
+	};
+
+	//! @brief a single handler operation (or control call) waiting for execution on the Db thread
+	struct DbOperation
+	{
+		DbControlOperation Control = DbControlOperation::None; //!< other than None: no handler, Type is meaningless
+		DbOperationType Type = DbOperationType::Save;
+		QSharedPointer<DbDataHandlerBase> spHandler;
+		QVariant Value;
+		DbOperationOptions Options;
+		quint64 ReadAllRequest = 0; //!< readAll() call a ReadAll operation belongs to, 0 for readAllFromHandler
+		QVariant CoalesceKey; //!< filled by push() from DbDataHandlerBase::coalesceKey
+		qint64 iBytes = 0; //!< estimated payload size, filled by push()
+	};
+
+	//! @brief DbOperationQueue is the bounded FIFO between DbHandlerPrivate (producers on any thread)
+	//! and ThreadedDbHandler (single consumer on the Db thread)
+	//! the consumer is only notified when the queue turns non-empty and is expected to drain it completely
+	class DbOperationQueue : public QObject
+	{
+		Q_OBJECT
+	public:
+		DbOperationQueue();
+		virtual ~DbOperationQueue();
+
+		void setLimits(const DbQueueLimits& Limits);
+		DbQueueLimits limits() const;
+
+		//! @brief the consumer thread is never blocked by DbQueueOverflowPolicy::BlockProducer
+		void setConsumerThread(QThread* pConsumerThread);
+
+		//! @brief returns false if the operation was rejected
+		//! control operations are always accepted, never dropped and never coalesced across
+		bool push(DbOperation Operation);
+		//! @brief non blocking, returns false if the queue is empty
+		bool pop(DbOperation& Operation);
+
+		DbQueueStatistics statistics() const;
+		//! @brief counts an operation that was taken from the queue (or dispatched otherwise) but not executed to the end
+		void recordAbandoned(DbAbandonReason Reason);
+
+		//! @brief rough size of a value, used for DbQueueLimits::MaxBytes
+		static qint64 estimateBytes(const QVariant& Value);
+
+	signals:
+		void operationsAvailable(); //!< the queue turned non-empty, the consumer should call pop() until it fails
+		void overflow(DbQueueOverflowPolicy Policy, DbOperationType Type, QUuid handlerUuid, quint64 ReadAllRequest);
+
+	private:
+		mutable QMutex m_mQueue; //!< protects all members below
+		QWaitCondition m_NotFull;
+		std::deque<DbOperation> m_Queue;
+		DbQueueLimits m_Limits;
+		DbQueueStatistics m_Statistics;
+		QThread* m_pConsumerThread = nullptr;
+		bool m_bConsumerNotified = false; //!< operationsAvailable was emitted and the consumer hasn't seen an empty queue yet
+
+		bool fits(qint64 iBytes) const; //!< m_mQueue must be locked
+		bool coalesce(DbOperation& Operation); //!< m_mQueue must be locked
+		bool pushControl(DbOperation Operation); //!< bypasses limits and overflow policies
+	};
+}
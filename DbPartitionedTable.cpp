@@ -0,0 +1,546 @@
+#include "DbPartitionedTable.h"
+#include "DbTransaction.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QSqlQuery>
+
+#include <algorithm>
+#include <utility>
+
+namespace PortableDBBackend
+{
+	namespace
+	{
+		const QString PeriodFormat("yyyyMMdd");
+
+		//! @brief partitions use the default rollback journal, a crash may leave it behind
+		bool removePartitionFile(const QString& FileName)
+		{
+			if (!QFile::remove(FileName))
+				return false;
+			QFile::remove(FileName + "-journal");
+			return true;
+		}
+	}
+
+	DbTimePartitionedTable::DbTimePartitionedTable(const QString& Table, const QString& ColumnDefinitions, DbPartitionPeriod Period,
+		int RetainedPeriods, const QStringList& IndexedColumns)
+		: m_Table(Table)
+		, m_bValid(QRegularExpression("^[A-Za-z_][A-Za-z0-9_]*$").match(Table).hasMatch())
+		, m_ColumnDefinitions(ColumnDefinitions)
+		, m_Period(Period)
+		, m_iRetainedPeriods(std::max(0, RetainedPeriods))
+		, m_IndexedColumns(IndexedColumns)
+	{
+	}
+
+	bool DbTimePartitionedTable::isValid() const
+	{
+		return m_bValid;
+	}
+
+	QString DbTimePartitionedTable::table() const
+	{
+		return m_Table;
+	}
+
+	DbPartitionPeriod DbTimePartitionedTable::period() const
+	{
+		return m_Period;
+	}
+
+	int DbTimePartitionedTable::retainedPeriods() const
+	{
+		return m_iRetainedPeriods;
+	}
+
+	QDate DbTimePartitionedTable::periodStart(const QDate& Date) const
+	{
+		switch (m_Period)
+		{
+		case DbPartitionPeriod::Day:
+			return Date;
+		case DbPartitionPeriod::Week:
+			return Date.addDays(1 - Date.dayOfWeek());
+		case DbPartitionPeriod::Month:
+			return QDate(Date.year(), Date.month(), 1);
+		case DbPartitionPeriod::Year:
+			return QDate(Date.year(), 1, 1);
+		}
+		return Date;
+	}
+
+	QDate DbTimePartitionedTable::shiftPeriods(const QDate& PeriodStart, int Periods) const
+	{
+		switch (m_Period)
+		{
+		case DbPartitionPeriod::Day:
+			return PeriodStart.addDays(Periods);
+		case DbPartitionPeriod::Week:
+			return PeriodStart.addDays(7 * static_cast<qint64>(Periods));
+		case DbPartitionPeriod::Month:
+			return PeriodStart.addMonths(Periods);
+		case DbPartitionPeriod::Year:
+			return PeriodStart.addYears(Periods);
+		}
+		return PeriodStart;
+	}
+
+	QString DbTimePartitionedTable::schemaName(const QDate& PeriodStart) const
+	{
+		return QString("part_%1_%2").arg(m_Table.toLower(), PeriodStart.toString(PeriodFormat));
+	}
+
+	QString DbTimePartitionedTable::fileName(const QString& MainDbFilename, const QDate& PeriodStart) const
+	{
+		return QString("%1.%2.%3").arg(MainDbFilename, m_Table.toLower(), PeriodStart.toString(PeriodFormat));
+	}
+
+	QString DbTimePartitionedTable::fileNamePattern(const QString& MainDbFilename) const
+	{
+		return QString("%1.%2.????????").arg(QFileInfo(MainDbFilename).fileName(), m_Table.toLower());
+	}
+
+	QDate DbTimePartitionedTable::periodStartFromFileName(const QString& MainDbFilename, const QString& FileName) const
+	{
+		const QString Prefix = QString("%1.%2.").arg(QFileInfo(MainDbFilename).fileName(), m_Table.toLower());
+		if (!FileName.startsWith(Prefix) || FileName.size() != Prefix.size() + PeriodFormat.size())
+			return QDate();
+		const QDate Start = QDate::fromString(FileName.mid(Prefix.size()), PeriodFormat);
+		// files of another period length (the definition changed) are left alone
+		if (!Start.isValid() || periodStart(Start) != Start)
+			return QDate();
+		return Start;
+	}
+
+	std::vector<QDate> DbTimePartitionedTable::existingPartitions(const QString& MainDbFilename) const
+	{
+		std::vector<QDate> Ret;
+		const QDir Dir(QFileInfo(MainDbFilename).absolutePath());
+		for (const QString& FileName : Dir.entryList(QStringList() << fileNamePattern(MainDbFilename), QDir::Files))
+		{
+			const QDate Start = periodStartFromFileName(MainDbFilename, FileName);
+			if (Start.isValid())
+			{
+				Ret.push_back(Start);
+			}
+		}
+		std::sort(Ret.begin(), Ret.end());
+		return Ret;
+	}
+
+	QStringList DbTimePartitionedTable::createStatements(const QString& Schema) const
+	{
+		QStringList Ret;
+		Ret << QString("CREATE TABLE IF NOT EXISTS %1.%2 ( %3 );").arg(Schema, m_Table, m_ColumnDefinitions);
+		for (int i = 0; i < m_IndexedColumns.size(); i++)
+		{
+			// the index name is qualified, the table name must not be
+			Ret << QString("CREATE INDEX IF NOT EXISTS %1.%2_idx%3 ON %2 ( %4 );").arg(Schema, m_Table).arg(i).arg(m_IndexedColumns[i]);
+		}
+		return Ret;
+	}
+
+	bool DbPartitionManager::addTable(const DbTimePartitionedTable& Table)
+	{
+		if (!Table.isValid())
+		{
+			qDebug() << "partitioned table " << Table.table() << " ... rejected, invalid name";
+			return false;
+		}
+		QMutexLocker Lock(&m_mPartitions);
+		const QString Key = Table.table().toLower();
+		// pinned write partitions can't be evicted, with too many tables even a single read couldn't attach anything
+		if (m_Tables.count(Key) == 0 && static_cast<int>(m_Tables.size()) >= MaxPartitionedTables)
+		{
+			qDebug() << "partitioned table " << Table.table() << " ... rejected, at most " << MaxPartitionedTables << " tables";
+			return false;
+		}
+		m_Tables.erase(Key);
+		m_Tables.emplace(Key, Table);
+		return true;
+	}
+
+	bool DbPartitionManager::hasTables() const
+	{
+		QMutexLocker Lock(&m_mPartitions);
+		return !m_Tables.empty();
+	}
+
+	bool DbPartitionManager::databaseOpened(QSqlDatabase& Db)
+	{
+		QMutexLocker Lock(&m_mPartitions);
+		m_Attached.erase(Db.connectionName());
+		const QDate Today = QDateTime::currentDateTimeUtc().date();
+		bool bSuccess = true;
+		for (const auto& Entry : m_Tables)
+		{
+			bSuccess = attachWritePartitions(Db, Entry.second, Entry.second.periodStart(Today)) && bSuccess;
+			retire(Db, Entry.second, Today);
+		}
+		return bSuccess;
+	}
+
+	void DbPartitionManager::connectionClosed(const QString& ConnectionName)
+	{
+		QMutexLocker Lock(&m_mPartitions);
+		m_Attached.erase(ConnectionName);
+		removePending();
+	}
+
+	QString DbPartitionManager::writeTable(QSqlDatabase& Db, const QString& Table, const QDateTime& Timestamp, DbPartitionStatus* pStatus)
+	{
+		DbPartitionStatus Status = DbPartitionStatus::Ok;
+		const QString QualifiedTable = routeWrite(Db, Table, Timestamp, Status);
+		if (pStatus)
+		{
+			*pStatus = Status;
+		}
+		return Status == DbPartitionStatus::Ok ? QualifiedTable : QString();
+	}
+
+	QString DbPartitionManager::routeWrite(QSqlDatabase& Db, const QString& Table, const QDateTime& Timestamp, DbPartitionStatus& Status)
+	{
+		QMutexLocker Lock(&m_mPartitions);
+		const DbTimePartitionedTable* pTable = findTable(Table);
+		if (!pTable || !Timestamp.isValid())
+		{
+			Status = DbPartitionStatus::UnknownTable;
+			return QString();
+		}
+
+		const QDate Today = QDateTime::currentDateTimeUtc().date();
+		const QDate PeriodStart = pTable->periodStart(Timestamp.toUTC().date());
+		const QString QualifiedTable = pTable->schemaName(PeriodStart) + '.' + pTable->table();
+		const bool bAttached = isAttached(Db.connectionName(), pTable->schemaName(PeriodStart));
+		if (DbTransaction::isInTransaction(Db))
+		{
+			// neither ATTACH nor the DETACH of retire work here, the next write outside a transaction catches up
+			if (!bAttached)
+			{
+				m_AttachRequests.insert(Db.connectionName());
+				Status = DbPartitionStatus::InTransaction;
+			}
+			return QualifiedTable;
+		}
+		if (PeriodStart < pTable->periodStart(Today))
+		{
+			// late row for a past period, its partition isn't kept attached
+			if (!bAttached && !attach(Db, *pTable, PeriodStart, true, false))
+			{
+				Status = DbPartitionStatus::AttachFailed;
+			}
+			return QualifiedTable;
+		}
+		if (bAttached && isAttached(Db.connectionName(), pTable->schemaName(pTable->shiftPeriods(PeriodStart, 1))))
+			return QualifiedTable;
+
+		// a new period started, or the next partition couldn't be attached so far (e.g. within a transaction)
+		const bool bSuccess = attachWritePartitions(Db, *pTable, PeriodStart);
+		if (!bAttached)
+		{
+			retire(Db, *pTable, Today);
+		}
+		if (!bSuccess && !bAttached)
+		{
+			Status = DbPartitionStatus::AttachFailed;
+		}
+		return QualifiedTable;
+	}
+
+	bool DbPartitionManager::takeAttachRequest(const QString& ConnectionName)
+	{
+		QMutexLocker Lock(&m_mPartitions);
+		return m_AttachRequests.erase(ConnectionName) > 0;
+	}
+
+	bool DbPartitionManager::forEachPartition(QSqlDatabase& Db, const QString& Table, const QDateTime& From, const QDateTime& To,
+		const std::function<bool(const QString& QualifiedTable)>& Visit)
+	{
+		if (!From.isValid() || !To.isValid() || !Visit)
+			return false;
+
+		std::vector<std::pair<QDate, QString>> Partitions; //!< period start, qualified table
+		{
+			QMutexLocker Lock(&m_mPartitions);
+			// files retired since our last visit must not be held open any longer
+			releaseStale(Db);
+			const DbTimePartitionedTable* pTable = findTable(Table);
+			if (!pTable)
+				return false;
+			const QDate FirstStart = pTable->periodStart(From.toUTC().date());
+			const QDate LastDate = To.toUTC().date();
+			for (const QDate& Start : pTable->existingPartitions(Db.databaseName()))
+			{
+				if (Start >= FirstStart && Start <= LastDate && m_PendingRemoval.count(pTable->fileName(Db.databaseName(), Start)) == 0)
+				{
+					Partitions.emplace_back(Start, pTable->schemaName(Start) + '.' + pTable->table());
+				}
+			}
+		}
+
+		for (const auto& Partition : Partitions)
+		{
+			{
+				// the lock isn't held while visiting, Visit may well write to another partitioned table
+				QMutexLocker Lock(&m_mPartitions);
+				const DbTimePartitionedTable* pTable = findTable(Table);
+				if (!pTable || !attach(Db, *pTable, Partition.first, false, false))
+					return false;
+			}
+			if (!Visit(Partition.second))
+				return false;
+		}
+		return true;
+	}
+
+	int DbPartitionManager::applyRetention(QSqlDatabase& Db, const QDateTime& Now)
+	{
+		QMutexLocker Lock(&m_mPartitions);
+		int iDropped = 0;
+		for (const auto& Entry : m_Tables)
+		{
+			iDropped += retire(Db, Entry.second, Now.toUTC().date());
+		}
+		return iDropped;
+	}
+
+	bool DbPartitionManager::dropAll(QSqlDatabase& Db)
+	{
+		QMutexLocker Lock(&m_mPartitions);
+		bool bSuccess = true;
+		AttachmentList& Attached = m_Attached[Db.connectionName()];
+		while (!Attached.empty())
+		{
+			if (!detach(Db, Attached.front().Schema))
+				return false;
+		}
+		for (const auto& Entry : m_Tables)
+		{
+			for (const QDate& Start : Entry.second.existingPartitions(Db.databaseName()))
+			{
+				const QString FileName = Entry.second.fileName(Db.databaseName(), Start);
+				const QString Schema = Entry.second.schemaName(Start);
+				if (isAttachedElsewhere(Db.connectionName(), Schema))
+				{
+					// the next writes reuse the file name, a deferred delete would hit the new partition
+					bool bEmptied = attach(Db, Entry.second, Start, false, false);
+					QSqlQuery Query(Db);
+					bEmptied = bEmptied && Query.exec(QString("DELETE FROM %1.%2;").arg(Schema, Entry.second.table()));
+					bEmptied = detach(Db, Schema) && bEmptied;
+					m_PendingRemoval.erase(FileName);
+					if (!bEmptied)
+					{
+						qDebug() << "emptying partition " << FileName << " ... failed !";
+						bSuccess = false;
+					}
+				}
+				else if (!removePartitionFile(FileName))
+				{
+					qDebug() << "deleting partition " << FileName << " ... failed !";
+					bSuccess = false;
+				}
+				else
+				{
+					m_PendingRemoval.erase(FileName);
+				}
+			}
+		}
+		// the write partitions are created again by the next writeTable
+		return bSuccess;
+	}
+
+	const DbTimePartitionedTable* DbPartitionManager::findTable(const QString& Table) const
+	{
+		auto It = m_Tables.find(Table.toLower());
+		return It != m_Tables.end() ? &It->second : nullptr;
+	}
+
+	bool DbPartitionManager::attachWritePartitions(QSqlDatabase& Db, const DbTimePartitionedTable& Table, const QDate& PeriodStart)
+	{
+		const bool bSuccess = attach(Db, Table, PeriodStart, true, true);
+		// created ahead of time, so the first write of the next period needs no ATTACH
+		const QDate NextStart = Table.shiftPeriods(PeriodStart, 1);
+		attach(Db, Table, NextStart, true, true);
+
+		// write partitions of past periods may be evicted from now on
+		const QString Key = Table.table().toLower();
+		const QString CurrentSchema = Table.schemaName(PeriodStart);
+		const QString NextSchema = Table.schemaName(NextStart);
+		for (Attachment& Entry : m_Attached[Db.connectionName()])
+		{
+			if (Entry.Table == Key && Entry.Schema != CurrentSchema && Entry.Schema != NextSchema)
+			{
+				Entry.bPinned = false;
+			}
+		}
+		return bSuccess;
+	}
+
+	bool DbPartitionManager::attach(QSqlDatabase& Db, const DbTimePartitionedTable& Table, const QDate& PeriodStart, bool bCreate, bool bPinned)
+	{
+		const QString Schema = Table.schemaName(PeriodStart);
+		AttachmentList& Attached = m_Attached[Db.connectionName()];
+		if (isAttached(Db.connectionName(), Schema))
+		{
+			Attached.back().bPinned = Attached.back().bPinned || bPinned;
+			return true;
+		}
+
+		const QString FileName = Table.fileName(Db.databaseName(), PeriodStart);
+		if (!bCreate && !QFile::exists(FileName))
+			return false;
+		if (m_PendingRemoval.count(FileName) > 0)
+		{
+			qDebug() << "attaching partition " << FileName << " ... failed, it is retired";
+			return false;
+		}
+
+		while (static_cast<int>(Attached.size()) >= MaxAttached)
+		{
+			auto It = std::find_if(Attached.begin(), Attached.end(), [](const Attachment& Entry) { return !Entry.bPinned; });
+			if (It == Attached.end() || !detach(Db, It->Schema))
+			{
+				qDebug() << "attaching partition " << FileName << " ... failed, no free slot";
+				return false;
+			}
+		}
+
+		QSqlQuery Query(Db);
+		Query.prepare(QString("ATTACH DATABASE ? AS %1;").arg(Schema));
+		Query.addBindValue(FileName);
+		if (!Query.exec())
+		{
+			qDebug() << "attaching partition " << FileName << " ... failed !";
+			return false;
+		}
+		Attached.push_back(Attachment{ Schema, Table.table().toLower(), bPinned, false });
+
+		if (bCreate)
+		{
+			for (const QString& Sql : Table.createStatements(Schema))
+			{
+				if (!Query.exec(Sql))
+				{
+					qDebug() << "Create SQL: " << Sql << " ... failed !";
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	bool DbPartitionManager::detach(QSqlDatabase& Db, const QString& Schema)
+	{
+		AttachmentList& Attached = m_Attached[Db.connectionName()];
+		auto It = std::find_if(Attached.begin(), Attached.end(), [&Schema](const Attachment& Entry) { return Entry.Schema == Schema; });
+		if (It == Attached.end())
+			return true;
+
+		// fails within a transaction or while a statement on the partition is still running
+		QSqlQuery Query(Db);
+		if (!Query.exec(QString("DETACH DATABASE %1;").arg(Schema)))
+			return false;
+		Attached.erase(It);
+		return true;
+	}
+
+	bool DbPartitionManager::isAttached(const QString& ConnectionName, const QString& Schema)
+	{
+		AttachmentList& Attached = m_Attached[ConnectionName];
+		auto It = std::find_if(Attached.begin(), Attached.end(), [&Schema](const Attachment& Entry) { return Entry.Schema == Schema; });
+		if (It == Attached.end())
+			return false;
+		// most recently used go last
+		std::rotate(It, It + 1, Attached.end());
+		return true;
+	}
+
+	bool DbPartitionManager::isAttachedElsewhere(const QString& ConnectionName, const QString& Schema) const
+	{
+		for (const auto& Entry : m_Attached)
+		{
+			if (Entry.first == ConnectionName)
+				continue;
+			if (std::any_of(Entry.second.begin(), Entry.second.end(), [&Schema](const Attachment& Attached) { return Attached.Schema == Schema; }))
+				return true;
+		}
+		return false;
+	}
+
+	void DbPartitionManager::releaseStale(QSqlDatabase& Db)
+	{
+		std::vector<QString> StaleSchemas;
+		for (const Attachment& Entry : m_Attached[Db.connectionName()])
+		{
+			if (Entry.bStale)
+			{
+				StaleSchemas.push_back(Entry.Schema);
+			}
+		}
+		for (const QString& Schema : StaleSchemas)
+		{
+			detach(Db, Schema);
+		}
+		removePending();
+	}
+
+	void DbPartitionManager::removePending()
+	{
+		for (auto It = m_PendingRemoval.begin(); It != m_PendingRemoval.end();)
+		{
+			if (isAttachedElsewhere(QString(), It->second))
+			{
+				++It;
+				continue;
+			}
+			if (removePartitionFile(It->first))
+			{
+				qDebug() << "retired partition " << It->first;
+			}
+			It = m_PendingRemoval.erase(It);
+		}
+	}
+
+	int DbPartitionManager::retire(QSqlDatabase& Db, const DbTimePartitionedTable& Table, const QDate& Today)
+	{
+		if (Table.retainedPeriods() <= 0)
+			return 0;
+
+		const QDate OldestKept = Table.shiftPeriods(Table.periodStart(Today), 1 - Table.retainedPeriods());
+		int iDropped = 0;
+		for (const QDate& Start : Table.existingPartitions(Db.databaseName()))
+		{
+			if (Start >= OldestKept)
+				break;
+			// still attached within a transaction: retried by the next retention
+			const QString Schema = Table.schemaName(Start);
+			if (!detach(Db, Schema))
+				continue;
+			const QString FileName = Table.fileName(Db.databaseName(), Start);
+			if (isAttachedElsewhere(Db.connectionName(), Schema))
+			{
+				// only the other connection's own thread may detach it
+				for (auto& Entry : m_Attached)
+				{
+					for (Attachment& Attached : Entry.second)
+					{
+						Attached.bStale = Attached.bStale || Attached.Schema == Schema;
+					}
+				}
+				m_PendingRemoval[FileName] = Schema;
+				continue;
+			}
+			if (removePartitionFile(FileName))
+			{
+				qDebug() << "retired partition " << FileName;
+				iDropped++;
+			}
+		}
+		return iDropped;
+	}
+}
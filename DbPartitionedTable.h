@@ -0,0 +1,148 @@
+#pragma once
+
+#include <QDate>
+#include <QDateTime>
+#include <QMutex>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+
+#include <functional>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace PortableDBBackend
+{
+	//! @brief time span covered by one partition file, weeks start on Monday
+	enum class DbPartitionPeriod
+	{
+		Day,
+		Week,
+		Month,
+		Year
+	};
+
+	//! @brief result of DbPartitionManager::writeTable
+	enum class DbPartitionStatus
+	{
+		Ok,
+		UnknownTable, //!< not declared with DbPartitionManager::addTable, or an invalid timestamp
+		InTransaction, //!< the partition isn't attached and ATTACH is impossible within the transaction, write after it ended
+		AttachFailed
+	};
+
+	//! @brief DbTimePartitionedTable declares an append-mostly table (logs, events, measurements) stored as one database file per period
+	//! the files live next to the main database and are ATTACHed on demand, retention deletes whole files instead of running DELETEs
+	//! rows are assigned to a partition by the UTC date of their timestamp
+	class DbTimePartitionedTable
+	{
+	public:
+		//! @param Table name of the table within every partition, letters, digits and '_' only, not starting with a digit
+		//! (it is part of SQL and file names), other names make the table invalid
+		//! @param ColumnDefinitions column list of CREATE TABLE, e.g. "ts INTEGER NOT NULL, kind TEXT, payload BLOB"
+		//! @param RetainedPeriods number of periods kept including the current one, 0 keeps everything
+		//! @param IndexedColumns one index per entry, e.g. "ts" or "kind, ts"
+		DbTimePartitionedTable(const QString& Table, const QString& ColumnDefinitions, DbPartitionPeriod Period,
+			int RetainedPeriods = 0, const QStringList& IndexedColumns = QStringList());
+
+		bool isValid() const; //!< false for a Table name that isn't a plain identifier, DbPartitionManager::addTable rejects it
+		QString table() const;
+		DbPartitionPeriod period() const;
+		int retainedPeriods() const;
+
+		//! @brief first day of the period containing Date
+		QDate periodStart(const QDate& Date) const;
+		//! @brief start of the period Periods periods after (negative: before) the period starting at PeriodStart
+		QDate shiftPeriods(const QDate& PeriodStart, int Periods) const;
+
+		//! @brief schema name the partition starting at PeriodStart is attached as
+		QString schemaName(const QDate& PeriodStart) const;
+		//! @brief e.g. "/docs/app.sqlite.events.20261001" for MainDbFilename "/docs/app.sqlite"
+		QString fileName(const QString& MainDbFilename, const QDate& PeriodStart) const;
+		//! @brief name filter matching all partition files of this table
+		QString fileNamePattern(const QString& MainDbFilename) const;
+		//! @brief period start encoded in a partition file name, invalid for other files
+		QDate periodStartFromFileName(const QString& MainDbFilename, const QString& FileName) const;
+
+		//! @brief period starts of the partition files of this table that exist next to MainDbFilename, oldest first
+		std::vector<QDate> existingPartitions(const QString& MainDbFilename) const;
+
+		//! @brief creates the table and its indexes in the attached Schema, all IF NOT EXISTS
+		QStringList createStatements(const QString& Schema) const;
+
+	private:
+		QString m_Table;
+		bool m_bValid;
+		QString m_ColumnDefinitions;
+		DbPartitionPeriod m_Period;
+		int m_iRetainedPeriods;
+		QStringList m_IndexedColumns;
+	};
+
+	//! @brief DbPartitionManager attaches, routes to and retires the partitions of all DbTimePartitionedTable of one database
+	//! each connection has its own attachments, the write partitions stay attached since ATTACH fails within transactions, all methods are thread safe
+	class DbPartitionManager
+	{
+	public:
+		static const int MaxAttached = 8; //!< SQLite allows 10 attached databases by default
+		static const int MaxPartitionedTables = (MaxAttached - 1) / 2; //!< two pinned write partitions each, one slot left for reads
+
+		//! @brief must be called before the database is opened
+		//! @return false for an invalid Table or if it would exceed MaxPartitionedTables, Table isn't added then
+		bool addTable(const DbTimePartitionedTable& Table);
+		bool hasTables() const;
+
+		//! @brief the main database on Db was (re)opened: attaches the write partitions and applies the retention
+		bool databaseOpened(QSqlDatabase& Db);
+		//! @brief forgets the attachments of a closed connection, deletes retired files no other connection has attached
+		void connectionClosed(const QString& ConnectionName);
+
+		//! @brief qualified name ("schema.table") to insert a row with Timestamp into, empty on failure, see pStatus
+		//! a partition that isn't attached fails with DbPartitionStatus::InTransaction within a transaction, see takeAttachRequest
+		QString writeTable(QSqlDatabase& Db, const QString& Table, const QDateTime& Timestamp, DbPartitionStatus* pStatus = nullptr);
+		//! @brief true once after writeTable failed with DbPartitionStatus::InTransaction on the connection
+		bool takeAttachRequest(const QString& ConnectionName);
+		//! @brief calls Visit with the qualified name of every existing partition overlapping [From, To], oldest first
+		//! partitions are attached one after another, so call it outside of transactions (readAll and readFromDb are),
+		//! queries on a partition must be finished when Visit returns, otherwise it can't be detached later on
+		//! @return false if a partition failed to attach or Visit returned false
+		bool forEachPartition(QSqlDatabase& Db, const QString& Table, const QDateTime& From, const QDateTime& To,
+			const std::function<bool(const QString& QualifiedTable)>& Visit);
+
+		//! @brief deletes the partition files older than the retention of their table
+		//! files attached by another connection are deleted once that connection detached them
+		//! @return number of partitions deleted right away
+		int applyRetention(QSqlDatabase& Db, const QDateTime& Now = QDateTime::currentDateTimeUtc());
+		//! @brief detaches and deletes all partition files, used by DataBackend::DeleteAllData
+		//! files attached by another connection are emptied instead, their names are reused by the next writes
+		bool dropAll(QSqlDatabase& Db);
+
+	private:
+		struct Attachment
+		{
+			QString Schema;
+			QString Table; //!< lower case key into m_Tables
+			bool bPinned; //!< write partition, never evicted
+			bool bStale; //!< its file is to be deleted, detached by the next forEachPartition of the connection
+		};
+		typedef std::vector<Attachment> AttachmentList; //!< least recently used first
+
+		mutable QMutex m_mPartitions; //!< protects all members below
+		std::map<QString, DbTimePartitionedTable> m_Tables; //!< key: table name in lower case
+		std::map<QString, AttachmentList> m_Attached; //!< key: Qt Sql connection name
+		std::map<QString, QString> m_PendingRemoval; //!< retired files still attached by another connection, key: file name, value: schema
+		std::set<QString> m_AttachRequests; //!< Qt Sql connection names, see takeAttachRequest
+
+		const DbTimePartitionedTable* findTable(const QString& Table) const;
+		QString routeWrite(QSqlDatabase& Db, const QString& Table, const QDateTime& Timestamp, DbPartitionStatus& Status);
+		bool attachWritePartitions(QSqlDatabase& Db, const DbTimePartitionedTable& Table, const QDate& PeriodStart);
+		bool attach(QSqlDatabase& Db, const DbTimePartitionedTable& Table, const QDate& PeriodStart, bool bCreate, bool bPinned);
+		bool detach(QSqlDatabase& Db, const QString& Schema);
+		bool isAttached(const QString& ConnectionName, const QString& Schema);
+		bool isAttachedElsewhere(const QString& ConnectionName, const QString& Schema) const;
+		void releaseStale(QSqlDatabase& Db); //!< detaches the stale attachments of Db, then removePending
+		void removePending(); //!< deletes the pending files no connection has attached anymore
+		int retire(QSqlDatabase& Db, const DbTimePartitionedTable& Table, const QDate& Today); //!< deletes partitions beyond the retention
+	};
+}
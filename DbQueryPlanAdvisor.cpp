@@ -0,0 +1,329 @@
+#include "DbQueryPlanAdvisor.h"
+#include "DbSqliteApi.h"
+
+#include <QRegularExpression>
+#include <QSet>
+#include <QSqlQuery>
+#include <QVariant>
+
+#include <algorithm>
+
+namespace PortableDBBackend
+{
+#ifdef PORTABLEDB_USE_SQLITE_API
+	namespace
+	{
+		int traceCallback(unsigned int Type, void* pContext, void* P, void* X)
+		{
+			if (Type == SQLITE_TRACE_PROFILE)
+			{
+				sqlite3_stmt* pStmt = static_cast<sqlite3_stmt*>(P);
+				const sqlite3_int64 Nanoseconds = *static_cast<sqlite3_int64*>(X);
+				static_cast<DbQueryPlanAdvisor*>(pContext)->record(QString::fromUtf8(sqlite3_sql(pStmt)), Nanoseconds);
+			}
+			return 0;
+		}
+	}
+#endif
+
+	DbQueryPlanAdvisor::DbQueryPlanAdvisor()
+	{
+	}
+
+	DbQueryPlanAdvisor::~DbQueryPlanAdvisor()
+	{
+		detach();
+	}
+
+	void DbQueryPlanAdvisor::attach(QSqlDatabase& Db)
+	{
+		detach();
+		m_AttachedDb = Db;
+#ifdef PORTABLEDB_USE_SQLITE_API
+		if (sqlite3* pDb = sqliteHandle(Db))
+		{
+			sqlite3_trace_v2(pDb, SQLITE_TRACE_PROFILE, &traceCallback, this);
+			QMutexLocker Lock(&m_mStatements);
+			m_TracedConnection = Db.connectionName();
+		}
+#endif
+	}
+
+	void DbQueryPlanAdvisor::detach()
+	{
+#ifdef PORTABLEDB_USE_SQLITE_API
+		if (sqlite3* pDb = sqliteHandle(m_AttachedDb))
+		{
+			sqlite3_trace_v2(pDb, 0, nullptr, nullptr);
+		}
+#endif
+		m_AttachedDb = QSqlDatabase();
+		QMutexLocker Lock(&m_mStatements);
+		m_TracedConnection.clear();
+	}
+
+	bool DbQueryPlanAdvisor::isAttached() const
+	{
+		return m_AttachedDb.isValid();
+	}
+
+	void DbQueryPlanAdvisor::setEnabled(bool bEnabled)
+	{
+		m_bEnabled = bEnabled;
+	}
+
+	bool DbQueryPlanAdvisor::isEnabled() const
+	{
+		return m_bEnabled;
+	}
+
+	bool DbQueryPlanAdvisor::tracesConnection(const QString& ConnectionName) const
+	{
+		QMutexLocker Lock(&m_mStatements);
+		return !m_TracedConnection.isEmpty() && m_TracedConnection == ConnectionName;
+	}
+
+	void DbQueryPlanAdvisor::record(const QString& Sql, qint64 Nanoseconds)
+	{
+		if (!m_bEnabled)
+			return;
+		const QString sTrimmed = Sql.trimmed();
+		if (sTrimmed.startsWith("EXPLAIN", Qt::CaseInsensitive))
+			return; // our own createReport
+		QMutexLocker Lock(&m_mStatements);
+		auto It = m_Statements.find(sTrimmed);
+		if (It == m_Statements.end())
+		{
+			if (m_Statements.size() >= m_MaxStatements)
+				return;
+			It = m_Statements.emplace(sTrimmed, StatementStatistics()).first;
+		}
+		It->second.ExecutionCount++;
+		It->second.TotalNanoseconds += Nanoseconds;
+	}
+
+	void DbQueryPlanAdvisor::clear()
+	{
+		QMutexLocker Lock(&m_mStatements);
+		m_Statements.clear();
+	}
+
+	DbQueryPlanReport DbQueryPlanAdvisor::createReport(QSqlDatabase& Db, const std::function<bool()>& IsAbandoned) const
+	{
+		DbQueryPlanReport Report;
+		// EXPLAIN runs through the traced connection as well, take a copy of the statement list first
+		std::map<QString, StatementStatistics> Statements;
+		{
+			QMutexLocker Lock(&m_mStatements);
+			Statements = m_Statements;
+		}
+		for (const auto& Statement : Statements)
+		{
+			if (IsAbandoned && IsAbandoned())
+				break;
+			DbStatementDiagnostics Diagnostics;
+			Diagnostics.Sql = Statement.first;
+			Diagnostics.ExecutionCount = Statement.second.ExecutionCount;
+			Diagnostics.TotalNanoseconds = Statement.second.TotalNanoseconds;
+			if (isExplainable(Statement.first))
+			{
+				Diagnostics.QueryPlan = explain(Db, Statement.first);
+				QStringList ScannedTables;
+				static const QRegularExpression ScanExp("^SCAN (?:TABLE )?(\\w+)(.*)$");
+				for (const QString& sDetail : Diagnostics.QueryPlan)
+				{
+					QRegularExpressionMatch Match = ScanExp.match(sDetail);
+					if (Match.hasMatch())
+					{
+						const QString sName = Match.captured(1);
+						const QString sRest = Match.captured(2);
+						// index usage, virtual tables (e.g. FTS5) and subqueries aren't real full scans
+						if (!sRest.contains("USING") && !sRest.contains("VIRTUAL TABLE")
+							&& sName.compare("SUBQUERY", Qt::CaseInsensitive) != 0 && sName.compare("CONSTANT", Qt::CaseInsensitive) != 0)
+						{
+							Diagnostics.bFullScan = true;
+							ScannedTables.append(sName);
+						}
+					}
+					if (sDetail.startsWith("USE TEMP B-TREE"))
+					{
+						Diagnostics.bTempBTree = true;
+					}
+				}
+				if (Diagnostics.bFullScan || Diagnostics.bTempBTree)
+				{
+					Diagnostics.SuggestedIndexes = suggestIndexes(Statement.first, ScannedTables, Diagnostics.bTempBTree);
+				}
+			}
+			Report.append(Diagnostics);
+		}
+		std::sort(Report.begin(), Report.end(), [](const DbStatementDiagnostics& A, const DbStatementDiagnostics& B) {
+			return A.TotalNanoseconds > B.TotalNanoseconds;
+		});
+		return Report;
+	}
+
+	QString DbQueryPlanAdvisor::formatReport(const DbQueryPlanReport& Report)
+	{
+		QString sReport;
+		for (const DbStatementDiagnostics& Diagnostics : Report)
+		{
+			sReport += QString("%1 x, %2 ms total: %3\n")
+				.arg(Diagnostics.ExecutionCount)
+				.arg(Diagnostics.TotalNanoseconds / 1000000.0, 0, 'f', 3)
+				.arg(Diagnostics.Sql);
+			for (const QString& sDetail : Diagnostics.QueryPlan)
+			{
+				sReport += "    plan: " + sDetail + "\n";
+			}
+			if (Diagnostics.bFullScan)
+				sReport += "    warning: full table scan\n";
+			if (Diagnostics.bTempBTree)
+				sReport += "    warning: temporary b-tree\n";
+			for (const QString& sIndex : Diagnostics.SuggestedIndexes)
+			{
+				sReport += "    heuristic suggestion, not verified against the plan: " + sIndex + "\n";
+			}
+		}
+		return sReport;
+	}
+
+	bool DbQueryPlanAdvisor::isExplainable(const QString& Sql)
+	{
+		static const QRegularExpression ExplainableExp("^\\s*(SELECT|UPDATE|DELETE|WITH)\\b", QRegularExpression::CaseInsensitiveOption);
+		return ExplainableExp.match(Sql).hasMatch();
+	}
+
+	QStringList DbQueryPlanAdvisor::explain(QSqlDatabase& Db, const QString& Sql)
+	{
+		QStringList Plan;
+		QSqlQuery Query(Db);
+		if (!Query.prepare("EXPLAIN QUERY PLAN " + Sql))
+			return Plan;
+
+		// QSQLITE insists on a value for every placeholder, NULL is fine for the plan
+		int iPlaceholders = 0;
+		QChar Quote;
+		for (int i = 0; i < Sql.size(); i++)
+		{
+			const QChar C = Sql[i];
+			if (!Quote.isNull())
+			{
+				if (C == Quote)
+					Quote = QChar();
+			}
+			else if (C == '\'' || C == '"')
+			{
+				Quote = C;
+			}
+			else if (C == '?' || ((C == ':' || C == '@' || C == '$') && i + 1 < Sql.size() && Sql[i + 1].isLetter()))
+			{
+				iPlaceholders++;
+			}
+		}
+		for (int i = 0; i < iPlaceholders; i++)
+		{
+			Query.bindValue(i, QVariant());
+		}
+		if (Query.exec())
+		{
+			while (Query.next())
+			{
+				Plan.append(Query.value(3).toString());
+			}
+		}
+		return Plan;
+	}
+
+	QStringList DbQueryPlanAdvisor::suggestIndexes(const QString& Sql, const QStringList& ScannedTables, bool bTempBTree)
+	{
+		static const QSet<QString> Keywords = { "WHERE", "JOIN", "LEFT", "INNER", "CROSS", "NATURAL", "ON", "ORDER", "GROUP", "LIMIT", "USING", "SET" };
+
+		// FROM/JOIN/UPDATE <table> [AS] <alias>
+		std::map<QString, QString> Tables; // name or alias -> table
+		static const QRegularExpression TableExp("\\b(?:FROM|JOIN|UPDATE)\\s+(\\w+)(?:\\s+(?:AS\\s+)?(\\w+))?", QRegularExpression::CaseInsensitiveOption);
+		auto TableIt = TableExp.globalMatch(Sql);
+		while (TableIt.hasNext())
+		{
+			QRegularExpressionMatch Match = TableIt.next();
+			Tables[Match.captured(1).toLower()] = Match.captured(1);
+			const QString sAlias = Match.captured(2);
+			if (!sAlias.isEmpty() && !Keywords.contains(sAlias.toUpper()))
+				Tables[sAlias.toLower()] = Match.captured(1);
+		}
+		const bool bSingleTable = Tables.size() <= 2; // a table and maybe its alias
+
+		static const QRegularExpression WhereExp("\\bWHERE\\b(.*?)(?:\\bGROUP\\s+BY\\b|\\bORDER\\s+BY\\b|\\bLIMIT\\b|$)",
+			QRegularExpression::CaseInsensitiveOption | QRegularExpression::DotMatchesEverythingOption);
+		static const QRegularExpression ConditionExp("(?:(\\w+)\\.)?(\\w+)\\s*(==|=|<=|>=|<|>|\\bIN\\b|\\bIS\\b|\\bBETWEEN\\b)",
+			QRegularExpression::CaseInsensitiveOption);
+		static const QRegularExpression OrderExp("\\bORDER\\s+BY\\b(.*?)(?:\\bLIMIT\\b|$)",
+			QRegularExpression::CaseInsensitiveOption | QRegularExpression::DotMatchesEverythingOption);
+
+		QStringList Suggestions;
+		QStringList Candidates = ScannedTables;
+		if (Candidates.isEmpty() && bTempBTree && bSingleTable && !Tables.empty())
+			Candidates.append(Tables.begin()->second); // sort on an indexed lookup, the ORDER BY columns may still help
+
+		for (const QString& sScanned : Candidates)
+		{
+			auto Resolved = Tables.find(sScanned.toLower());
+			const QString sTable = Resolved != Tables.end() ? Resolved->second : sScanned;
+			auto BelongsToTable = [&](const QString& sQualifier) {
+				if (sQualifier.isEmpty())
+					return bSingleTable;
+				auto It = Tables.find(sQualifier.toLower());
+				return It != Tables.end() && It->second.compare(sTable, Qt::CaseInsensitive) == 0;
+			};
+
+			// equality columns first, then at most one range column, then the sort order
+			QStringList EqualityColumns, RangeColumns, OrderColumns;
+			QRegularExpressionMatch WhereMatch = WhereExp.match(Sql);
+			if (WhereMatch.hasMatch())
+			{
+				auto ConditionIt = ConditionExp.globalMatch(WhereMatch.captured(1));
+				while (ConditionIt.hasNext())
+				{
+					QRegularExpressionMatch Condition = ConditionIt.next();
+					const QString sColumn = Condition.captured(2);
+					const QString sOperator = Condition.captured(3).toUpper();
+					if (Keywords.contains(sColumn.toUpper()) || sColumn.at(0).isDigit() || !BelongsToTable(Condition.captured(1)))
+						continue;
+					QStringList& Target = (sOperator == "=" || sOperator == "==" || sOperator == "IN" || sOperator == "IS") ? EqualityColumns : RangeColumns;
+					if (!Target.contains(sColumn, Qt::CaseInsensitive))
+						Target.append(sColumn);
+				}
+			}
+			if (bTempBTree)
+			{
+				QRegularExpressionMatch OrderMatch = OrderExp.match(Sql);
+				if (OrderMatch.hasMatch())
+				{
+					for (QString sTerm : OrderMatch.captured(1).split(','))
+					{
+						sTerm = sTerm.trimmed().section(' ', 0, 0);
+						const QString sQualifier = sTerm.contains('.') ? sTerm.section('.', 0, 0) : QString();
+						const QString sColumn = sTerm.section('.', -1);
+						if (!sColumn.isEmpty() && BelongsToTable(sQualifier))
+							OrderColumns.append(sColumn);
+					}
+				}
+			}
+
+			QStringList IndexColumns = EqualityColumns;
+			if (!RangeColumns.isEmpty())
+				IndexColumns.append(RangeColumns.first());
+			for (const QString& sColumn : OrderColumns)
+			{
+				if (!IndexColumns.contains(sColumn, Qt::CaseInsensitive))
+					IndexColumns.append(sColumn);
+			}
+			if (IndexColumns.isEmpty())
+				continue; // scans without any filter or order can't be helped by an index
+
+			Suggestions.append(QString("CREATE INDEX IF NOT EXISTS idx_%1_%2 ON %1 (%3);")
+				.arg(sTable, IndexColumns.join('_'), IndexColumns.join(", ")));
+		}
+		return Suggestions;
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <QMetaType>
+#include <QMutex>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <atomic>
+#include <functional>
+#include <map>
+
+namespace PortableDBBackend
+{
+	//! @brief everything the query plan advisor knows about one distinct statement
+	struct DbStatementDiagnostics
+	{
+		QString Sql; //!< as prepared, parameters are not expanded
+		quint64 ExecutionCount = 0;
+		qint64 TotalNanoseconds = 0;
+		QStringList QueryPlan; //!< detail lines of EXPLAIN QUERY PLAN
+		bool bFullScan = false; //!< a table is scanned without index
+		bool bTempBTree = false; //!< ORDER BY/GROUP BY/DISTINCT needs a temporary b-tree
+		QStringList SuggestedIndexes; //!< heuristic CREATE INDEX statements from the WHERE/ORDER BY columns, not verified against the plan
+	};
+	using DbQueryPlanReport = QVector<DbStatementDiagnostics>;
+
+	//! @brief DbQueryPlanAdvisor collects the statements executed by DbHandler and explains them on request
+	//! with PORTABLEDB_USE_SQLITE_API every statement of the attached connection is traced (sqlite3_trace_v2),
+	//! statements on other connections and, without the flag, all handler statements are recorded through
+	//! DbDataHandlerBase::execQuery/publishRowSet
+	//! attach, detach and createReport belong to the Db thread, setEnabled, record and clear are thread safe
+	class DbQueryPlanAdvisor
+	{
+	public:
+		DbQueryPlanAdvisor();
+		~DbQueryPlanAdvisor();
+
+		//! @brief starts/stops capturing on Db, detach before Db is closed
+		void attach(QSqlDatabase& Db);
+		void detach();
+		bool isAttached() const;
+
+		//! @brief record ignores statements while disabled, see DbHandler::setQueryDiagnostics
+		void setEnabled(bool bEnabled);
+		bool isEnabled() const;
+		//! @brief true if statements on ConnectionName are already seen by the trace hook and must not be recorded again
+		bool tracesConnection(const QString& ConnectionName) const;
+
+		void record(const QString& Sql, qint64 Nanoseconds);
+		void clear();
+
+		//! @brief runs EXPLAIN QUERY PLAN for every recorded statement, most expensive first
+		//! stops early once IsAbandoned returns true, the report then covers the statements explained so far
+		DbQueryPlanReport createReport(QSqlDatabase& Db, const std::function<bool()>& IsAbandoned = nullptr) const;
+		//! @brief human readable form of a report, e.g. for logging
+		static QString formatReport(const DbQueryPlanReport& Report);
+
+	private:
+		struct StatementStatistics
+		{
+			quint64 ExecutionCount = 0;
+			qint64 TotalNanoseconds = 0;
+		};
+		std::atomic<bool> m_bEnabled{ false };
+		mutable QMutex m_mStatements; //!< protects m_Statements and m_TracedConnection, never held while SQL runs
+		std::map<QString, StatementStatistics> m_Statements;
+		QString m_TracedConnection;
+		QSqlDatabase m_AttachedDb;
+		static const size_t m_MaxStatements = 1000; //!< statements with inlined literals must not grow the map forever
+
+		static bool isExplainable(const QString& Sql);
+		static QStringList explain(QSqlDatabase& Db, const QString& Sql);
+		static QStringList suggestIndexes(const QString& Sql, const QStringList& ScannedTables, bool bTempBTree);
+	};
+}
+
+Q_DECLARE_METATYPE(PortableDBBackend::DbQueryPlanReport);
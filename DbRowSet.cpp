@@ -0,0 +1,496 @@
+#include "DbRowSet.h"
+#include "DbSqliteApi.h"
+
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QSqlRecord>
+#include <QSharedData>
+
+namespace PortableDBBackend
+{
+	//! @brief one typed column buffer, text and blob share the arena layout
+	struct DbRowSetColumn
+	{
+		QString Name;
+		DbColumnType Type = DbColumnType::Null;
+		std::vector<qint64> Int64;
+		std::vector<double> Double;
+		QByteArray Arena;
+		std::vector<qint64> Offsets{ 0 }; //!< rowCount+1 entries, bytes of row i are [Offsets[i], Offsets[i+1])
+		std::vector<bool> Null;
+		std::vector<QVariant> Variants; //!< DbColumnType::Variant only
+
+		void setType(DbColumnType NewType, size_t RowsSoFar)
+		{
+			// rows before the first non-null value are NULL, give them a slot in the typed buffer
+			Type = NewType;
+			switch (Type)
+			{
+			case DbColumnType::Int64:
+				Int64.assign(RowsSoFar, 0);
+				break;
+			case DbColumnType::Double:
+				Double.assign(RowsSoFar, 0.0);
+				break;
+			case DbColumnType::Text:
+			case DbColumnType::Blob:
+				Offsets.assign(RowsSoFar + 1, 0);
+				break;
+			case DbColumnType::Variant:
+				Variants.assign(RowsSoFar, QVariant());
+				break;
+			case DbColumnType::Null:
+				break;
+			}
+		}
+
+		void appendNull()
+		{
+			Null.push_back(true);
+			appendDefault();
+		}
+
+		void appendInt64(qint64 iValue)
+		{
+			if (Type == DbColumnType::Null)
+				setType(DbColumnType::Int64, Null.size());
+			// a double holds integers up to 2^53 exactly, everything else keeps its own storage class
+			const bool bExactDouble = iValue >= -(Q_INT64_C(1) << 53) && iValue <= (Q_INT64_C(1) << 53);
+			if (Type != DbColumnType::Int64 && !(Type == DbColumnType::Double && bExactDouble))
+				makeVariant();
+			Null.push_back(false);
+			switch (Type)
+			{
+			case DbColumnType::Int64: Int64.push_back(iValue); break;
+			case DbColumnType::Double: Double.push_back(static_cast<double>(iValue)); break;
+			default: Variants.push_back(QVariant(iValue)); break;
+			}
+		}
+
+		void appendDouble(double dValue)
+		{
+			if (Type == DbColumnType::Null)
+				setType(DbColumnType::Double, Null.size());
+			if (Type != DbColumnType::Double)
+				makeVariant();
+			Null.push_back(false);
+			if (Type == DbColumnType::Double)
+				Double.push_back(dValue);
+			else
+				Variants.push_back(QVariant(dValue));
+		}
+
+		void appendBytes(const char* pData, int iSize, DbColumnType BytesType)
+		{
+			if (Type == DbColumnType::Null)
+				setType(BytesType, Null.size());
+			if (Type != BytesType)
+				makeVariant();
+			Null.push_back(false);
+			if (Type == BytesType)
+			{
+				Arena.append(pData, iSize);
+				Offsets.push_back(Arena.size());
+			}
+			else
+			{
+				Variants.push_back(BytesType == DbColumnType::Text ? QVariant(QString::fromUtf8(pData, iSize)) : QVariant(QByteArray(pData, iSize)));
+			}
+		}
+
+		void appendVariant(const QVariant& Value)
+		{
+			if (Value.isNull())
+			{
+				appendNull();
+				return;
+			}
+			switch (Value.userType())
+			{
+			case QMetaType::Int:
+			case QMetaType::UInt:
+			case QMetaType::LongLong:
+			case QMetaType::ULongLong:
+			case QMetaType::Bool:
+				appendInt64(Value.toLongLong());
+				break;
+			case QMetaType::Double:
+			case QMetaType::Float:
+				appendDouble(Value.toDouble());
+				break;
+			case QMetaType::QByteArray:
+			{
+				const QByteArray Bytes = Value.toByteArray();
+				appendBytes(Bytes.constData(), Bytes.size(), DbColumnType::Blob);
+				break;
+			}
+			default:
+			{
+				const QByteArray Utf8 = Value.toString().toUtf8();
+				appendBytes(Utf8.constData(), Utf8.size(), DbColumnType::Text);
+				break;
+			}
+			}
+		}
+
+	private:
+		//! @brief value of row i as stored in the typed buffers
+		QVariant typedValue(size_t i) const
+		{
+			switch (Type)
+			{
+			case DbColumnType::Int64: return QVariant(Int64[i]);
+			case DbColumnType::Double: return QVariant(Double[i]);
+			case DbColumnType::Text: return QVariant(QString::fromUtf8(Arena.constData() + Offsets[i], static_cast<int>(Offsets[i + 1] - Offsets[i])));
+			case DbColumnType::Blob: return QVariant(QByteArray(Arena.constData() + Offsets[i], static_cast<int>(Offsets[i + 1] - Offsets[i])));
+			default: return QVariant();
+			}
+		}
+
+		//! @brief moves all rows so far into Variants, called for the first value of another storage class
+		void makeVariant()
+		{
+			if (Type == DbColumnType::Variant)
+				return;
+			std::vector<QVariant> Values;
+			Values.reserve(Null.size());
+			for (size_t i = 0; i < Null.size(); i++)
+			{
+				Values.push_back(Null[i] ? QVariant() : typedValue(i));
+			}
+			Int64.clear();
+			Double.clear();
+			Arena.clear();
+			Offsets.assign(1, 0);
+			Variants.swap(Values);
+			Type = DbColumnType::Variant;
+		}
+
+		void appendDefault()
+		{
+			switch (Type)
+			{
+			case DbColumnType::Int64: Int64.push_back(0); break;
+			case DbColumnType::Double: Double.push_back(0.0); break;
+			case DbColumnType::Text:
+			case DbColumnType::Blob: Offsets.push_back(Arena.size()); break;
+			case DbColumnType::Variant: Variants.push_back(QVariant()); break;
+			case DbColumnType::Null: break;
+			}
+		}
+	};
+
+	class DbRowSetData : public QSharedData
+	{
+	public:
+		std::vector<DbRowSetColumn> Columns;
+		int iRowCount = 0;
+		bool bValid = false;
+		QString Error;
+
+		const DbRowSetColumn* column(int Column) const
+		{
+			if (Column < 0 || Column >= static_cast<int>(Columns.size()))
+				return nullptr;
+			return &Columns[Column];
+		}
+	};
+
+	DbRowSet::DbRowSet()
+		: d(new DbRowSetData)
+	{
+	}
+
+	DbRowSet::DbRowSet(const DbRowSet& Other) = default;
+	DbRowSet& DbRowSet::operator=(const DbRowSet& Other) = default;
+	DbRowSet::~DbRowSet() = default;
+
+	DbRowSet DbRowSet::fromQuery(QSqlQuery& Query)
+	{
+		DbRowSet RowSet;
+		DbRowSetData* pData = RowSet.d.data();
+		if (!Query.isActive())
+		{
+			pData->Error = Query.lastError().text();
+			return RowSet;
+		}
+		const QSqlRecord Record = Query.record();
+		pData->Columns.resize(Record.count());
+		for (int i = 0; i < Record.count(); i++)
+		{
+			pData->Columns[i].Name = Record.fieldName(i);
+		}
+		while (Query.next())
+		{
+			for (int i = 0; i < Record.count(); i++)
+			{
+				pData->Columns[i].appendVariant(Query.value(i));
+			}
+			pData->iRowCount++;
+		}
+		pData->bValid = true;
+		return RowSet;
+	}
+
+	DbRowSet DbRowSet::fromSql(QSqlDatabase& Db, const QString& Sql, const QVariantList& BindValues)
+	{
+#ifdef PORTABLEDB_USE_SQLITE_API
+		if (sqlite3* pDb = sqliteHandle(Db))
+		{
+			DbRowSet RowSet;
+			DbRowSetData* pData = RowSet.d.data();
+			sqlite3_stmt* pStmt = nullptr;
+			const QByteArray SqlUtf8 = Sql.toUtf8();
+			if (sqlite3_prepare_v2(pDb, SqlUtf8.constData(), SqlUtf8.size(), &pStmt, nullptr) != SQLITE_OK)
+			{
+				pData->Error = QString::fromUtf8(sqlite3_errmsg(pDb));
+				return RowSet;
+			}
+			for (int i = 0; i < BindValues.size(); i++)
+			{
+				const QVariant& Value = BindValues[i];
+				if (Value.isNull())
+				{
+					sqlite3_bind_null(pStmt, i + 1);
+					continue;
+				}
+				switch (Value.userType())
+				{
+				case QMetaType::Int:
+				case QMetaType::UInt:
+				case QMetaType::LongLong:
+				case QMetaType::ULongLong:
+				case QMetaType::Bool:
+					sqlite3_bind_int64(pStmt, i + 1, Value.toLongLong());
+					break;
+				case QMetaType::Double:
+				case QMetaType::Float:
+					sqlite3_bind_double(pStmt, i + 1, Value.toDouble());
+					break;
+				case QMetaType::QByteArray:
+				{
+					const QByteArray Bytes = Value.toByteArray();
+					sqlite3_bind_blob(pStmt, i + 1, Bytes.constData(), Bytes.size(), SQLITE_TRANSIENT);
+					break;
+				}
+				default:
+				{
+					const QByteArray Utf8 = Value.toString().toUtf8();
+					sqlite3_bind_text(pStmt, i + 1, Utf8.constData(), Utf8.size(), SQLITE_TRANSIENT);
+					break;
+				}
+				}
+			}
+			const int iColumns = sqlite3_column_count(pStmt);
+			pData->Columns.resize(iColumns);
+			for (int i = 0; i < iColumns; i++)
+			{
+				pData->Columns[i].Name = QString::fromUtf8(sqlite3_column_name(pStmt, i));
+			}
+			int iStep = SQLITE_ROW;
+			while ((iStep = sqlite3_step(pStmt)) == SQLITE_ROW)
+			{
+				for (int i = 0; i < iColumns; i++)
+				{
+					DbRowSetColumn& Column = pData->Columns[i];
+					switch (sqlite3_column_type(pStmt, i))
+					{
+					case SQLITE_INTEGER:
+						Column.appendInt64(sqlite3_column_int64(pStmt, i));
+						break;
+					case SQLITE_FLOAT:
+						Column.appendDouble(sqlite3_column_double(pStmt, i));
+						break;
+					case SQLITE_TEXT:
+					{
+						const char* pText = reinterpret_cast<const char*>(sqlite3_column_text(pStmt, i));
+						Column.appendBytes(pText, sqlite3_column_bytes(pStmt, i), DbColumnType::Text);
+						break;
+					}
+					case SQLITE_BLOB:
+					{
+						const char* pBlob = static_cast<const char*>(sqlite3_column_blob(pStmt, i));
+						Column.appendBytes(pBlob, sqlite3_column_bytes(pStmt, i), DbColumnType::Blob);
+						break;
+					}
+					default:
+						Column.appendNull();
+						break;
+					}
+				}
+				pData->iRowCount++;
+			}
+			if (iStep == SQLITE_DONE)
+			{
+				pData->bValid = true;
+			}
+			else
+			{
+				pData->Error = QString::fromUtf8(sqlite3_errmsg(pDb));
+			}
+			sqlite3_finalize(pStmt);
+			return RowSet;
+		}
+#endif
+		QSqlQuery Query(Db);
+		Query.setForwardOnly(true); // no result caching inside QtSql, we copy everything anyway
+		if (!Query.prepare(Sql))
+		{
+			return fromQuery(Query);
+		}
+		for (int i = 0; i < BindValues.size(); i++)
+		{
+			Query.bindValue(i, BindValues[i]);
+		}
+		Query.exec();
+		return fromQuery(Query);
+	}
+
+	bool DbRowSet::isValid() const
+	{
+		return d->bValid;
+	}
+
+	QString DbRowSet::errorString() const
+	{
+		return d->Error;
+	}
+
+	int DbRowSet::rowCount() const
+	{
+		return d->iRowCount;
+	}
+
+	int DbRowSet::columnCount() const
+	{
+		return static_cast<int>(d->Columns.size());
+	}
+
+	QString DbRowSet::columnName(int Column) const
+	{
+		const DbRowSetColumn* pColumn = d->column(Column);
+		return pColumn ? pColumn->Name : QString();
+	}
+
+	int DbRowSet::columnIndex(const QString& ColumnName) const
+	{
+		for (int i = 0; i < columnCount(); i++)
+		{
+			if (d->Columns[i].Name.compare(ColumnName, Qt::CaseInsensitive) == 0)
+				return i;
+		}
+		return -1;
+	}
+
+	DbColumnType DbRowSet::columnType(int Column) const
+	{
+		const DbRowSetColumn* pColumn = d->column(Column);
+		return pColumn ? pColumn->Type : DbColumnType::Null;
+	}
+
+	bool DbRowSet::isNull(int Row, int Column) const
+	{
+		const DbRowSetColumn* pColumn = d->column(Column);
+		if (!pColumn || Row < 0 || Row >= d->iRowCount)
+			return true;
+		return pColumn->Null[Row];
+	}
+
+	qint64 DbRowSet::int64Value(int Row, int Column) const
+	{
+		if (isNull(Row, Column))
+			return 0;
+		const DbRowSetColumn& Col = d->Columns[Column];
+		switch (Col.Type)
+		{
+		case DbColumnType::Int64: return Col.Int64[Row];
+		case DbColumnType::Double: return static_cast<qint64>(Col.Double[Row]);
+		case DbColumnType::Variant: return Col.Variants[Row].toLongLong();
+		default: return rawBytes(Row, Column).toLongLong();
+		}
+	}
+
+	double DbRowSet::doubleValue(int Row, int Column) const
+	{
+		if (isNull(Row, Column))
+			return 0.0;
+		const DbRowSetColumn& Col = d->Columns[Column];
+		switch (Col.Type)
+		{
+		case DbColumnType::Int64: return static_cast<double>(Col.Int64[Row]);
+		case DbColumnType::Double: return Col.Double[Row];
+		case DbColumnType::Variant: return Col.Variants[Row].toDouble();
+		default: return rawBytes(Row, Column).toDouble();
+		}
+	}
+
+	QString DbRowSet::textValue(int Row, int Column) const
+	{
+		if (isNull(Row, Column))
+			return QString();
+		const DbRowSetColumn& Col = d->Columns[Column];
+		switch (Col.Type)
+		{
+		case DbColumnType::Int64: return QString::number(Col.Int64[Row]);
+		case DbColumnType::Double: return QString::number(Col.Double[Row], 'g', 17);
+		case DbColumnType::Variant:
+		{
+			const QVariant& Value = Col.Variants[Row];
+			if (Value.userType() == QMetaType::Double)
+				return QString::number(Value.toDouble(), 'g', 17);
+			return Value.toString();
+		}
+		default: return QString::fromUtf8(rawBytes(Row, Column));
+		}
+	}
+
+	QByteArray DbRowSet::rawBytes(int Row, int Column) const
+	{
+		if (isNull(Row, Column))
+			return QByteArray();
+		const DbRowSetColumn& Col = d->Columns[Column];
+		if (Col.Type == DbColumnType::Variant && Col.Variants[Row].userType() == QMetaType::QByteArray)
+			return Col.Variants[Row].toByteArray();
+		if (Col.Type != DbColumnType::Text && Col.Type != DbColumnType::Blob)
+			return textValue(Row, Column).toUtf8();
+		const qint64 iBegin = Col.Offsets[Row];
+		return QByteArray::fromRawData(Col.Arena.constData() + iBegin, static_cast<int>(Col.Offsets[Row + 1] - iBegin));
+	}
+
+	QVariant DbRowSet::value(int Row, int Column) const
+	{
+		if (isNull(Row, Column))
+			return QVariant();
+		switch (d->Columns[Column].Type)
+		{
+		case DbColumnType::Int64: return QVariant(int64Value(Row, Column));
+		case DbColumnType::Double: return QVariant(doubleValue(Row, Column));
+		case DbColumnType::Text: return QVariant(textValue(Row, Column));
+		case DbColumnType::Blob:
+		{
+			// deep copy, the QVariant may outlive this DbRowSet
+			const QByteArray Raw = rawBytes(Row, Column);
+			return QVariant(QByteArray(Raw.constData(), Raw.size()));
+		}
+		case DbColumnType::Variant: return d->Columns[Column].Variants[Row];
+		case DbColumnType::Null: break;
+		}
+		return QVariant();
+	}
+
+	const qint64* DbRowSet::int64Column(int Column) const
+	{
+		const DbRowSetColumn* pColumn = d->column(Column);
+		if (!pColumn || pColumn->Type != DbColumnType::Int64)
+			return nullptr;
+		return pColumn->Int64.data();
+	}
+
+	const double* DbRowSet::doubleColumn(int Column) const
+	{
+		const DbRowSetColumn* pColumn = d->column(Column);
+		if (!pColumn || pColumn->Type != DbColumnType::Double)
+			return nullptr;
+		return pColumn->Double.data();
+	}
+}
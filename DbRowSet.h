@@ -0,0 +1,77 @@
+#pragma once
+
+#include <QByteArray>
+#include <QMetaType>
+#include <QSharedDataPointer>
+#include <QString>
+#include <QVariant>
+
+#include <vector>
+
+class QSqlDatabase;
+class QSqlQuery;
+
+namespace PortableDBBackend
+{
+	//! @brief storage type of a DbRowSet column, taken from the first non-null value of the column
+	//! a later value of another storage class turns the column into Variant instead of being converted (and possibly lost),
+	//! only integers a Double column represents exactly are stored there as well
+	enum class DbColumnType
+	{
+		Null, //!< all values of the column are NULL
+		Int64,
+		Double,
+		Text, //!< UTF-8 in a per column arena
+		Blob,
+		Variant //!< mixed storage classes, one QVariant per cell with the value as read
+	};
+
+	class DbRowSetData;
+
+	//! @brief DbRowSet is a read-only, column oriented query result
+	//! every column is stored in one contiguous typed buffer (int64, double or a byte arena with offsets for text/blob)
+	//! instead of one QVariant per cell
+	//! DbRowSet is implicitly shared, copies (e.g. through a queued connection) do not copy the buffers
+	class DbRowSet
+	{
+	public:
+		DbRowSet();
+		DbRowSet(const DbRowSet& Other);
+		DbRowSet& operator=(const DbRowSet& Other);
+		~DbRowSet();
+
+		//! @brief reads all remaining rows of an already executed query
+		static DbRowSet fromQuery(QSqlQuery& Query);
+		//! @brief prepares, binds (positional) and executes Sql on Db and reads all rows
+		//! with PORTABLEDB_USE_SQLITE_API the statement is stepped directly without any QVariant per cell
+		static DbRowSet fromSql(QSqlDatabase& Db, const QString& Sql, const QVariantList& BindValues = QVariantList());
+
+		bool isValid() const; //!< false if the query failed
+		QString errorString() const;
+
+		int rowCount() const;
+		int columnCount() const;
+		QString columnName(int Column) const;
+		int columnIndex(const QString& ColumnName) const; //!< -1 for unknown names
+		DbColumnType columnType(int Column) const;
+
+		// cell access, values of a different column type are converted like SQLite does
+		bool isNull(int Row, int Column) const;
+		qint64 int64Value(int Row, int Column) const;
+		double doubleValue(int Row, int Column) const;
+		QString textValue(int Row, int Column) const;
+		//! @brief text or blob bytes, the returned QByteArray references the arena and must not outlive this DbRowSet
+		//! (Variant columns return a copy)
+		QByteArray rawBytes(int Row, int Column) const;
+		QVariant value(int Row, int Column) const; //!< convenience, allocates like QSqlQuery::value()
+
+		// whole column access for scans, nullptr if the column has another type (including Variant)
+		const qint64* int64Column(int Column) const;
+		const double* doubleColumn(int Column) const;
+
+	private:
+		QSharedDataPointer<DbRowSetData> d;
+	};
+}
+
+Q_DECLARE_METATYPE(PortableDBBackend::DbRowSet);
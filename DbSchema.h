@@ -0,0 +1,356 @@
+#pragma once
+//! compile-time table schema descriptors
+//!
+//!	using Orders = DbSchema::Table<"orders",
+//!		DbSchema::Column<"id", qint64, DbSchema::PrimaryKey>,
+//!		DbSchema::Column<"customer", QString, DbSchema::NotNull>,
+//!		DbSchema::Column<"total", double>>;
+//!	DbHandler.addTableType<Orders>();
+//!
+//! all SQL text (create, delete, insert, update, select) is generated by the compiler,
+//! values are bound by position from a std::tuple or from a struct providing tie()
+//! requires C++20 (class types as non-type template parameters)
+
+#include "databackend.h"
+
+#include <QByteArray>
+#include <QSqlQuery>
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#if !defined(__cpp_nontype_template_args) || __cpp_nontype_template_args < 201911L
+#error "DbSchema.h requires C++20 (CONFIG += c++2a)"
+#endif
+
+namespace PortableDBBackend
+{
+namespace DbSchema
+{
+	//! @brief string literal usable as template argument
+	template <size_t N>
+	struct FixedString
+	{
+		char Data[N]{};
+
+		constexpr FixedString(const char (&Str)[N])
+		{
+			for (size_t i = 0; i < N; i++)
+				Data[i] = Str[i];
+		}
+		constexpr const char* c_str() const { return Data; }
+	};
+
+	// column constraints
+	struct PrimaryKey {};
+	struct NotNull {};
+	struct Unique {};
+
+	//! @brief SQLite column type for the supported C++ value types, std::optional<T> marks a nullable column
+	template <class T, class Enable = void> struct SqlType;
+	template <class T> struct SqlType<T, std::enable_if_t<std::is_integral_v<T>>> { static constexpr const char* Name = "INTEGER"; };
+	template <class T> struct SqlType<T, std::enable_if_t<std::is_floating_point_v<T>>> { static constexpr const char* Name = "REAL"; };
+	template <> struct SqlType<QString> { static constexpr const char* Name = "TEXT"; };
+	template <> struct SqlType<QByteArray> { static constexpr const char* Name = "BLOB"; };
+	template <class T> struct SqlType<std::optional<T>> { static constexpr const char* Name = SqlType<T>::Name; };
+
+	template <FixedString ColumnName, class T, class... Constraints>
+	struct Column
+	{
+		using ValueType = T;
+		static constexpr const char* Name = ColumnName.c_str();
+		static constexpr const char* Type = SqlType<T>::Name;
+		static constexpr bool IsPrimaryKey = (std::is_same_v<Constraints, PrimaryKey> || ...);
+		static constexpr bool IsNotNull = (std::is_same_v<Constraints, NotNull> || ...);
+		static constexpr bool IsUnique = (std::is_same_v<Constraints, Unique> || ...);
+	};
+
+	namespace Detail
+	{
+		//! @brief writes SQL text, with a nullptr buffer it only counts the characters
+		struct SqlWriter
+		{
+			char* pOut = nullptr;
+			size_t iSize = 0;
+
+			constexpr SqlWriter& operator<<(const char* pStr)
+			{
+				for (; *pStr; pStr++, iSize++)
+				{
+					if (pOut)
+						pOut[iSize] = *pStr;
+				}
+				return *this;
+			}
+		};
+
+		//! @brief runs Builder::write twice: once to size the buffer, once to fill it
+		template <class Builder>
+		constexpr auto makeSql()
+		{
+			constexpr size_t Length = [] { SqlWriter Counter; Builder::write(Counter); return Counter.iSize; }();
+			std::array<char, Length + 1> Buffer{};
+			SqlWriter Writer{ Buffer.data() };
+			Builder::write(Writer);
+			return Buffer;
+		}
+
+		//! @brief writes the names of all columns for which Filter is true, separated by Separator, each followed by Suffix
+		template <class... Columns, class Filter>
+		constexpr void writeNames(SqlWriter& W, Filter&& Pred, const char* Suffix, const char* Separator)
+		{
+			bool bFirst = true;
+			auto WriteOne = [&](bool bSelected, const char* pName) {
+				if (!bSelected)
+					return;
+				if (!bFirst)
+					W << Separator;
+				W << pName << Suffix;
+				bFirst = false;
+			};
+			(WriteOne(Pred(Columns::IsPrimaryKey), Columns::Name), ...);
+		}
+
+		template <class T> QVariant toVariant(const T& Value) { return QVariant::fromValue(Value); }
+		inline QVariant toVariant(const QString& Value) { return QVariant(Value); }
+		inline QVariant toVariant(const QByteArray& Value) { return QVariant(Value); }
+		inline QVariant toVariant(bool bValue) { return QVariant(bValue ? 1 : 0); }
+		template <class T> QVariant toVariant(const std::optional<T>& Value) { return Value ? toVariant(*Value) : QVariant(); }
+
+		template <class T> struct FromVariant { static T get(const QVariant& Value) { return Value.value<T>(); } };
+		template <class T> struct FromVariant<std::optional<T>>
+		{
+			static std::optional<T> get(const QVariant& Value)
+			{
+				if (Value.isNull())
+					return std::nullopt;
+				return Value.value<T>();
+			}
+		};
+
+		template <class T> struct IsTuple : std::false_type {};
+		template <class... T> struct IsTuple<std::tuple<T...>> : std::true_type {};
+	}
+
+	//! @brief ITableDefinition generated from its columns
+	//! derive from it and override NeedUpdate/getUpdateStatement/insertInitialRows for schema migrations
+	template <FixedString TableName, class... Columns>
+	class Table : public ITableDefinition
+	{
+		static_assert(sizeof...(Columns) > 0, "a table needs at least one column");
+
+	public:
+		using Row = std::tuple<typename Columns::ValueType...>;
+		static constexpr const char* Name = TableName.c_str();
+		static constexpr size_t ColumnCount = sizeof...(Columns);
+		static constexpr size_t KeyCount = (size_t(Columns::IsPrimaryKey) + ...);
+		static constexpr std::array<bool, ColumnCount> IsKey{ Columns::IsPrimaryKey... };
+
+	private:
+		struct CreateBuilder
+		{
+			static constexpr void write(Detail::SqlWriter& W)
+			{
+				W << "CREATE TABLE " << Name << " (";
+				bool bFirst = true;
+				auto WriteColumn = [&](const char* pName, const char* pType, bool bKey, bool bNotNull, bool bUnique) {
+					if (!bFirst)
+						W << ", ";
+					W << pName << " " << pType;
+					if (bKey && KeyCount == 1)
+						W << " PRIMARY KEY";
+					if (bNotNull)
+						W << " NOT NULL";
+					if (bUnique)
+						W << " UNIQUE";
+					bFirst = false;
+				};
+				(WriteColumn(Columns::Name, Columns::Type, Columns::IsPrimaryKey, Columns::IsNotNull, Columns::IsUnique), ...);
+				if constexpr (KeyCount > 1)
+				{
+					W << ", PRIMARY KEY (";
+					Detail::writeNames<Columns...>(W, [](bool bKey) { return bKey; }, "", ", ");
+					W << ")";
+				}
+				W << ");";
+			}
+		};
+		struct DeleteAllBuilder
+		{
+			static constexpr void write(Detail::SqlWriter& W) { W << "DELETE FROM " << Name << ";"; }
+		};
+		struct InsertBuilder
+		{
+			static constexpr void write(Detail::SqlWriter& W)
+			{
+				W << "INSERT INTO " << Name << " (";
+				Detail::writeNames<Columns...>(W, [](bool) { return true; }, "", ", ");
+				W << ") VALUES (";
+				for (size_t i = 0; i < ColumnCount; i++)
+					W << (i == 0 ? "?" : ", ?");
+				W << ");";
+			}
+		};
+		struct UpdateBuilder
+		{
+			static constexpr void write(Detail::SqlWriter& W)
+			{
+				W << "UPDATE " << Name << " SET ";
+				Detail::writeNames<Columns...>(W, [](bool bKey) { return !bKey; }, " = ?", ", ");
+				W << " WHERE ";
+				Detail::writeNames<Columns...>(W, [](bool bKey) { return bKey; }, " = ?", " AND ");
+				W << ";";
+			}
+		};
+		struct SelectBuilder
+		{
+			static constexpr void write(Detail::SqlWriter& W)
+			{
+				W << "SELECT ";
+				Detail::writeNames<Columns...>(W, [](bool) { return true; }, "", ", ");
+				W << " FROM " << Name;
+			}
+		};
+		struct SelectByKeyBuilder
+		{
+			static constexpr void write(Detail::SqlWriter& W)
+			{
+				SelectBuilder::write(W);
+				W << " WHERE ";
+				Detail::writeNames<Columns...>(W, [](bool bKey) { return bKey; }, " = ?", " AND ");
+				W << ";";
+			}
+		};
+		struct DeleteByKeyBuilder
+		{
+			static constexpr void write(Detail::SqlWriter& W)
+			{
+				W << "DELETE FROM " << Name << " WHERE ";
+				Detail::writeNames<Columns...>(W, [](bool bKey) { return bKey; }, " = ?", " AND ");
+				W << ";";
+			}
+		};
+
+		static constexpr auto m_CreateSql = Detail::makeSql<CreateBuilder>();
+		static constexpr auto m_DeleteAllSql = Detail::makeSql<DeleteAllBuilder>();
+		static constexpr auto m_InsertSql = Detail::makeSql<InsertBuilder>();
+		static constexpr auto m_UpdateSql = Detail::makeSql<UpdateBuilder>();
+		static constexpr auto m_SelectAllSql = Detail::makeSql<SelectBuilder>();
+		static constexpr auto m_SelectByKeySql = Detail::makeSql<SelectByKeyBuilder>();
+		static constexpr auto m_DeleteByKeySql = Detail::makeSql<DeleteByKeyBuilder>();
+
+	public:
+		// generated SQL, positional placeholders follow the column declaration order
+		static constexpr const char* createSql() { return m_CreateSql.data(); }
+		static constexpr const char* insertSql() { return m_InsertSql.data(); }
+		//! non-key columns first, then the key columns for the WHERE clause, see bindUpdate
+		//! tables consisting of key columns only have nothing to update, insert and delete their rows instead
+		static constexpr const char* updateSql()
+		{
+			static_assert(KeyCount < ColumnCount, "every column is a key column, there is nothing to SET");
+			return KeyCount > 0 ? m_UpdateSql.data() : nullptr;
+		}
+		static constexpr const char* selectAllSql() { return m_SelectAllSql.data(); } //!< without ';' to allow appending WHERE/ORDER BY
+		static constexpr const char* selectByKeySql() { return KeyCount > 0 ? m_SelectByKeySql.data() : nullptr; }
+		static constexpr const char* deleteByKeySql() { return KeyCount > 0 ? m_DeleteByKeySql.data() : nullptr; }
+
+		// ITableDefinition
+		virtual QStringList getCreateStatements(int /*TargetVersion*/) const override
+		{
+			return QStringList(QString::fromLatin1(createSql()));
+		}
+		virtual bool NeedUpdate(int /*OldVersion*/, int /*UpdatedVersion*/) const override { return false; }
+		virtual QStringList getUpdateStatement(int /*OldVersion*/, int /*TargetVersion*/) const override { return QStringList(); }
+		virtual QStringList getDeleteStatements() const override
+		{
+			return QStringList(QString::fromLatin1(m_DeleteAllSql.data()));
+		}
+
+		// positional binders, Values is a Row or a struct with a tie() member returning a tuple in column order
+		template <class Values>
+		static void bindInsert(QSqlQuery& Query, const Values& Value)
+		{
+			bindAll(Query, asTuple(Value), std::make_index_sequence<ColumnCount>());
+		}
+		template <class Values>
+		static void bindUpdate(QSqlQuery& Query, const Values& Value)
+		{
+			static_assert(KeyCount > 0, "updates need a primary key");
+			static_assert(KeyCount < ColumnCount, "every column is a key column, there is nothing to SET");
+			bindUpdateImpl(Query, asTuple(Value), std::make_index_sequence<ColumnCount>());
+		}
+		//! @brief binds the key columns only, for selectByKeySql/deleteByKeySql
+		template <class Values>
+		static void bindKey(QSqlQuery& Query, const Values& Value)
+		{
+			static_assert(KeyCount > 0, "key access needs a primary key");
+			bindKeyImpl(Query, asTuple(Value), std::make_index_sequence<ColumnCount>());
+		}
+		//! @brief reads the current row of a query on selectAllSql/selectByKeySql
+		static Row readRow(const QSqlQuery& Query)
+		{
+			return readRowImpl(Query, std::make_index_sequence<ColumnCount>());
+		}
+
+	private:
+		template <class Values>
+		static auto asTuple(const Values& Value)
+		{
+			if constexpr (Detail::IsTuple<Values>::value)
+			{
+				static_assert(std::tuple_size_v<Values> == ColumnCount, "tuple does not match the column count");
+				return Value;
+			}
+			else
+			{
+				auto Tied = Value.tie();
+				static_assert(std::tuple_size_v<decltype(Tied)> == ColumnCount, "tie() does not match the column count");
+				return Tied;
+			}
+		}
+
+		template <size_t I, class Tuple>
+		static QVariant columnValue(const Tuple& Values)
+		{
+			using ColumnType = std::tuple_element_t<I, Row>;
+			using ValueType = std::decay_t<std::tuple_element_t<I, Tuple>>;
+			static_assert(std::is_convertible_v<ValueType, ColumnType>, "value type does not match the column type");
+			return Detail::toVariant(static_cast<ColumnType>(std::get<I>(Values)));
+		}
+
+		template <class Tuple, size_t... I>
+		static void bindAll(QSqlQuery& Query, const Tuple& Values, std::index_sequence<I...>)
+		{
+			(Query.bindValue(static_cast<int>(I), columnValue<I>(Values)), ...);
+		}
+
+		template <class Tuple, size_t... I>
+		static void bindUpdateImpl(QSqlQuery& Query, const Tuple& Values, std::index_sequence<I...>)
+		{
+			int iPos = 0;
+			((IsKey[I] ? void() : Query.bindValue(iPos++, columnValue<I>(Values))), ...);
+			((IsKey[I] ? Query.bindValue(iPos++, columnValue<I>(Values)) : void()), ...);
+		}
+
+		template <class Tuple, size_t... I>
+		static void bindKeyImpl(QSqlQuery& Query, const Tuple& Values, std::index_sequence<I...>)
+		{
+			int iPos = 0;
+			((IsKey[I] ? Query.bindValue(iPos++, columnValue<I>(Values)) : void()), ...);
+		}
+
+		template <size_t... I>
+		static Row readRowImpl(const QSqlQuery& Query, std::index_sequence<I...>)
+		{
+			return Row(Detail::FromVariant<std::tuple_element_t<I, Row>>::get(Query.value(static_cast<int>(I)))...);
+		}
+	};
+}
+}
@@ -0,0 +1,28 @@
+#pragma once
+//! direct access to the SQLite C API below QtSql
+//! only available if PORTABLEDB_USE_SQLITE_API is defined, which requires Qt to use the same (system) SQLite library
+//! the application links against, see PortableDbBackend.pri
+
+#ifdef PORTABLEDB_USE_SQLITE_API
+
+#include <QSqlDatabase>
+#include <QSqlDriver>
+#include <QVariant>
+
+#include <sqlite3.h>
+
+namespace PortableDBBackend
+{
+	//! @brief returns the sqlite3 connection behind Db or nullptr if Db isn't an open QSQLITE connection
+	inline sqlite3* sqliteHandle(const QSqlDatabase& Db)
+	{
+		if (!Db.isOpen() || !Db.driver())
+			return nullptr;
+		QVariant Handle = Db.driver()->handle();
+		if (!Handle.isValid() || qstrcmp(Handle.typeName(), "sqlite3*") != 0)
+			return nullptr;
+		return *static_cast<sqlite3**>(Handle.data());
+	}
+}
+
+#endif
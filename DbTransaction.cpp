@@ -0,0 +1,173 @@
+#include "DbTransaction.h"
+#include "DbSqliteApi.h"
+
+#include <QMutex>
+#include <QSqlQuery>
+
+#include <map>
+
+namespace PortableDBBackend
+{
+	namespace
+	{
+		// open DbTransaction scopes per Qt Sql connection name, every connection is used by one thread at a time
+		QMutex s_mDepths;
+		std::map<QString, int> s_Depths;
+
+		int enterScope(const QString& ConnectionName)
+		{
+			QMutexLocker Lock(&s_mDepths);
+			return s_Depths[ConnectionName]++;
+		}
+
+		void leaveScope(const QString& ConnectionName)
+		{
+			QMutexLocker Lock(&s_mDepths);
+			auto It = s_Depths.find(ConnectionName);
+			if (It != s_Depths.end() && --It->second <= 0)
+			{
+				s_Depths.erase(It);
+			}
+		}
+	}
+
+	DbTransaction::DbTransaction(QSqlDatabase& Db, DbTransactionMode Mode)
+		: m_Db(Db)
+	{
+		if (!m_Db.isOpen())
+			return;
+
+		const int iDepth = enterScope(m_Db.connectionName());
+		bool bNested = iDepth > 0;
+#ifdef PORTABLEDB_USE_SQLITE_API
+		if (sqlite3* pDb = sqliteHandle(m_Db))
+		{
+			// a transaction we didn't open
+			bNested = bNested || sqlite3_get_autocommit(pDb) == 0;
+		}
+#endif
+		if (bNested)
+		{
+			m_Savepoint = QString("PortableDb_Savepoint%1").arg(iDepth);
+			m_bActive = exec(QString("SAVEPOINT %1;").arg(m_Savepoint));
+		}
+		else
+		{
+			// a failure (e.g. SQLITE_BUSY) is reported as it is, a savepoint would silently start a deferred transaction instead
+			m_bActive = exec(Mode == DbTransactionMode::Immediate ? "BEGIN IMMEDIATE;" : "BEGIN;");
+		}
+		if (!m_bActive)
+		{
+			leaveScope(m_Db.connectionName());
+		}
+	}
+
+	DbTransaction::~DbTransaction()
+	{
+		if (m_bActive)
+		{
+			rollback();
+		}
+	}
+
+	bool DbTransaction::isActive() const
+	{
+		return m_bActive;
+	}
+
+	bool DbTransaction::isNested() const
+	{
+		return !m_Savepoint.isEmpty();
+	}
+
+	bool DbTransaction::commit()
+	{
+		if (!m_bActive)
+			return false;
+
+#ifdef PORTABLEDB_USE_SQLITE_API
+		sqlite3* pDb = isNested() ? nullptr : sqliteHandle(m_Db);
+		if (pDb && sqlite3_get_autocommit(pDb) != 0)
+		{
+			// committed or rolled back by someone else, e.g. QSqlDatabase::commit() of a handler
+			m_LastError = QSqlError(QString(), "the transaction was ended outside of DbTransaction", QSqlError::TransactionError);
+			finish();
+			return false;
+		}
+#endif
+		const bool bSuccess = exec(isNested() ? QString("RELEASE %1;").arg(m_Savepoint) : QString("COMMIT;"));
+		if (!bSuccess)
+		{
+			const QSqlError CommitError = m_LastError;
+			rollback();
+#ifdef PORTABLEDB_USE_SQLITE_API
+			// errors like SQLITE_FULL roll back the transaction by themselves, our ROLLBACK fails then
+			m_bRolledBack = m_bRolledBack || (pDb && sqlite3_get_autocommit(pDb) != 0);
+#endif
+			m_LastError = CommitError;
+			return false;
+		}
+		finish();
+		return true;
+	}
+
+	bool DbTransaction::rollback()
+	{
+		if (!m_bActive)
+			return false;
+
+		bool bSuccess = false;
+		if (isNested())
+		{
+			// ROLLBACK TO keeps the savepoint open, RELEASE removes it
+			bSuccess = exec(QString("ROLLBACK TO %1;").arg(m_Savepoint));
+			bSuccess = exec(QString("RELEASE %1;").arg(m_Savepoint)) && bSuccess;
+		}
+		else
+		{
+			bSuccess = exec("ROLLBACK;");
+		}
+		m_bRolledBack = bSuccess;
+		finish();
+		return bSuccess;
+	}
+
+	bool DbTransaction::isRolledBack() const
+	{
+		return m_bRolledBack;
+	}
+
+	QSqlError DbTransaction::lastError() const
+	{
+		return m_LastError;
+	}
+
+	bool DbTransaction::isInTransaction(const QSqlDatabase& Db)
+	{
+		{
+			QMutexLocker Lock(&s_mDepths);
+			if (s_Depths.count(Db.connectionName()) > 0)
+				return true;
+		}
+#ifdef PORTABLEDB_USE_SQLITE_API
+		if (sqlite3* pDb = sqliteHandle(Db))
+			return sqlite3_get_autocommit(pDb) == 0;
+#endif
+		return false;
+	}
+
+	bool DbTransaction::exec(const QString& Sql)
+	{
+		QSqlQuery Query(m_Db);
+		if (Query.exec(Sql))
+			return true;
+		m_LastError = Query.lastError();
+		return false;
+	}
+
+	void DbTransaction::finish()
+	{
+		m_bActive = false;
+		leaveScope(m_Db.connectionName());
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QString>
+
+namespace PortableDBBackend
+{
+	//! @brief locking of an outermost transaction, see BEGIN in the SQLite documentation
+	enum class DbTransactionMode
+	{
+		Deferred, //!< locks are taken by the first read/write
+		Immediate //!< takes the write lock at once, avoids SQLITE_BUSY when a read transaction has to be upgraded
+	};
+
+	//! @brief DbTransaction is a transaction scope on a connection
+	//! the outermost scope of a connection runs BEGIN/COMMIT, nested scopes run SAVEPOINT/RELEASE,
+	//! so handlers can use it no matter whether DbHandler already batches their operations in a transaction
+	//! a failed BEGIN (e.g. SQLITE_BUSY) leaves the scope inactive, check isActive/lastError
+	//! a transaction opened by someone else (e.g. QSqlDatabase::transaction()) is only detected and nested into
+	//! with PORTABLEDB_USE_SQLITE_API, otherwise BEGIN fails within it
+	//! scopes that are neither committed nor rolled back roll back when destroyed, e.g. on exceptions or early returns
+	//! scopes of one connection must end in reverse order of their creation, which stack objects do by themselves
+	class DbTransaction
+	{
+	public:
+		explicit DbTransaction(QSqlDatabase& Db, DbTransactionMode Mode = DbTransactionMode::Deferred);
+		~DbTransaction();
+
+		DbTransaction(const DbTransaction&) = delete;
+		DbTransaction& operator=(const DbTransaction&) = delete;
+
+		//! @brief false if BEGIN/SAVEPOINT failed or the scope was already committed/rolled back
+		bool isActive() const;
+		//! @brief true for SAVEPOINT scopes, whose commit only becomes durable with the enclosing transaction
+		bool isNested() const;
+
+		//! @brief COMMIT, respectively RELEASE of the savepoint, a failed commit rolls back
+		bool commit();
+		//! @brief ROLLBACK, respectively ROLLBACK TO and RELEASE of the savepoint
+		bool rollback();
+		//! @brief true once rollback() or a failed commit() is known to have undone the scope's changes
+		//! false if someone else ended the transaction (e.g. QSqlDatabase::commit()), its changes may well be committed
+		bool isRolledBack() const;
+
+		QSqlError lastError() const;
+
+		//! @brief true within a DbTransaction scope of Db, with PORTABLEDB_USE_SQLITE_API also within transactions opened by someone else
+		static bool isInTransaction(const QSqlDatabase& Db);
+
+	private:
+		QSqlDatabase& m_Db;
+		QString m_Savepoint; //!< empty for the outermost scope
+		bool m_bActive = false;
+		bool m_bRolledBack = false;
+		QSqlError m_LastError;
+
+		bool exec(const QString& Sql);
+		void finish();
+	};
+}
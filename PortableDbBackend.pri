@@ -1,9 +1,40 @@
 QT += sql
+# DbSchema.h uses class types as template parameters
+CONFIG += c++2a
+
+# define PORTABLEDB_USE_SQLITE_API to let the backend use the SQLite C API where QtSql has no equivalent
+# this is only safe if the Qt SQLite plugin is built against the same library (-system-sqlite)
+#DEFINES += PORTABLEDB_USE_SQLITE_API
+#LIBS += -lsqlite3
 
 SOURCES += \
     PortableDBBackend/databackend.cpp \
     PortableDBBackend/databackend_pimpl.cpp \
+    PortableDBBackend/DbHandler.cpp \
+    PortableDBBackend/DbHandlerPrivate.cpp \
+    PortableDBBackend/DbOperationQueue.cpp \
+    PortableDBBackend/DbFtsTable.cpp \
+    PortableDBBackend/DbAggregateTable.cpp \
+    PortableDBBackend/DbQueryPlanAdvisor.cpp \
+    PortableDBBackend/DbCheckpointScheduler.cpp \
+    PortableDBBackend/DbRowSet.cpp \
+    PortableDBBackend/DbColumnCodec.cpp \
+    PortableDBBackend/DbTransaction.cpp \
+    PortableDBBackend/DbPartitionedTable.cpp \
 
 HEADERS += \
     PortableDBBackend/databackend.h \
     PortableDBBackend/databackend_pimpl.h \
+    PortableDBBackend/DbHandler.h \
+    PortableDBBackend/DbHandlerPrivate.h \
+    PortableDBBackend/DbOperationQueue.h \
+    PortableDBBackend/DbFtsTable.h \
+    PortableDBBackend/DbAggregateTable.h \
+    PortableDBBackend/DbQueryPlanAdvisor.h \
+    PortableDBBackend/DbCheckpointScheduler.h \
+    PortableDBBackend/DbRowSet.h \
+    PortableDBBackend/DbColumnCodec.h \
+    PortableDBBackend/DbTransaction.h \
+    PortableDBBackend/DbPartitionedTable.h \
+    PortableDBBackend/DbSchema.h \
+    PortableDBBackend/DbSqliteApi.h \
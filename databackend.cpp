@@ -28,11 +28,36 @@ void DataBackend::setDbVersion(int CurrentVersion)
   m_spPImpl->setDbVersion(CurrentVersion);
 }
 
+void DataBackend::setTemplateDatabase(const QString& TemplateFilename)
+{
+  m_spPImpl->setTemplateDatabase(TemplateFilename);
+}
+
+bool DataBackend::CreateTemplateDatabase(const QString& TemplateFilename)
+{
+  return m_spPImpl->CreateTemplateDatabase(TemplateFilename);
+}
+
+QString DataBackend::SchemaFingerprint() const
+{
+  return m_spPImpl->SchemaFingerprint();
+}
+
 void DataBackend::AddTable(std::unique_ptr<ITableDefinition> Table)
 {
   m_spPImpl->AddTable(std::move(Table));
 }
 
+bool DataBackend::AddPartitionedTable(const DbTimePartitionedTable& Table)
+{
+  return m_spPImpl->AddPartitionedTable(Table);
+}
+
+std::shared_ptr<DbPartitionManager> DataBackend::Partitions() const
+{
+  return m_spPImpl->Partitions();
+}
+
 bool DataBackend::DeleteAllData(QSqlDatabase& DbToDelete)
 {
 	return m_spPImpl->DeleteAllData(DbToDelete);
@@ -5,6 +5,8 @@
 #include <QSqlDatabase>
 #include <QStringList>
 #include <memory>
+#include "DbColumnCodec.h"
+#include "DbPartitionedTable.h"
 namespace PortableDBBackend
 {
 class ITableDefinition
@@ -18,6 +20,15 @@ public:
   // optional: fill freshly created tables with values
   virtual QStringList insertInitialRows(int /*TargetVersion*/) const
   { QStringList Empty; return Empty; }
+
+  // optional: false for a definition that can't create its tables, AddTable rejects it
+  virtual bool isValid() const
+  { return true; }
+
+  // optional: BLOB/TEXT columns stored through a DbColumnCodec (compressed above a size threshold)
+  // DbHandler collects them in AddTable, handlers use DbDataHandlerBase::encodeColumn/decodeColumn
+  virtual QList<DbCodecColumn> codecColumns() const
+  { return QList<DbCodecColumn>(); }
 };
 
 // forward declarations
@@ -29,8 +40,14 @@ public:
   DataBackend();
   virtual ~DataBackend();
 
-  // AddTable must be called before InitializeDB
+  // AddTable must be called before InitializeDB, invalid definitions (ITableDefinition::isValid) are ignored
   void AddTable(std::unique_ptr<ITableDefinition> Table); // as we take ownership of the Table the returned unique_ptr will be empty
+  // optional: append-mostly table stored as one ATTACHed file per period next to the db file, must be called before InitializeDB as well
+  // rows are written to Partitions()->writeTable(...) and read with Partitions()->forEachPartition(...)
+  // returns false for invalid tables and if every table couldn't keep its two write partitions attached, see DbPartitionManager::addTable
+  bool AddPartitionedTable(const DbTimePartitionedTable& Table);
+  // shared by all connections to the db, thread safe
+  std::shared_ptr<DbPartitionManager> Partitions() const;
 
 public slots:
   // this will attempt to open/create/update the db
@@ -39,6 +56,15 @@ public slots:
   bool DeleteAllData(QSqlDatabase& DbToDelete);
 
   void setDbVersion(int CurrentVersion); // call in c'tor of derived classes to support DB updates
+
+  // optional: a new file is copied from this prebuilt database (e.g. from Qt resources) instead of creating all tables
+  // the template must be written by CreateTemplateDatabase with the same tables and version, stale templates are ignored
+  void setTemplateDatabase(const QString& TemplateFilename);
+  // build step: writes all tables, their initial rows and the schema fingerprint to a new file TemplateFilename
+  // the library ships no generator target, the app's build runs its own small tool calling this with its tables
+  bool CreateTemplateDatabase(const QString& TemplateFilename);
+  // hash of the version, create statements and initial rows of all tables
+  QString SchemaFingerprint() const;
 protected:
 	template <class TableType> void addTableType()
   {
@@ -1,6 +1,9 @@
 #include "databackend_pimpl.h"
+#include "DbTransaction.h"
 
+#include <QCryptographicHash>
 #include <QDir>
+#include <QFile>
 #include <QStandardPaths>
 #include <QDebug>
 #include <QSqlQuery>
@@ -8,14 +11,18 @@
 namespace PortableDBBackend
 {
 DataBackend_pImpl::DataBackend_pImpl()
-  : QObject(nullptr)
+  : QObject(nullptr),
+    m_ConnectionName(QString("PortableDbBackend_%1").arg(reinterpret_cast<quintptr>(this))),
+    m_spPartitions(std::make_shared<DbPartitionManager>())
 {
   AddTable(std::unique_ptr<ITableDefinition>(new DbTableVersion));
 }
 
 DataBackend_pImpl::~DataBackend_pImpl()
 {
-
+  // the copies held by our owner are gone by now, otherwise Qt warns about a connection still in use
+  if (QSqlDatabase::contains(m_ConnectionName))
+    QSqlDatabase::removeDatabase(m_ConnectionName);
 }
 
 void DataBackend_pImpl::setDbVersion(int CurrentVersion)
@@ -25,9 +32,24 @@ void DataBackend_pImpl::setDbVersion(int CurrentVersion)
 
 void DataBackend_pImpl::AddTable(std::unique_ptr<ITableDefinition> spTable)
 {
+  if (!spTable || !spTable->isValid())
+  {
+    qDebug() << "table definition rejected, it is invalid";
+    return;
+  }
   m_Tables.push_back(std::move(spTable));
 }
 
+bool DataBackend_pImpl::AddPartitionedTable(const DbTimePartitionedTable& Table)
+{
+  return m_spPartitions->addTable(Table);
+}
+
+std::shared_ptr<DbPartitionManager> DataBackend_pImpl::Partitions() const
+{
+  return m_spPartitions;
+}
+
 bool DataBackend_pImpl::InitializeDB(const QString& ProposedFilename, QSqlDatabase& DataBase)
 {
   // this will attempt to open, if that fails the db is going to be created and initialized
@@ -49,10 +71,10 @@ bool DataBackend_pImpl::InitializeDB(const QString& ProposedFilename, QSqlDataba
     DBFile += "/";
     DBFile += ProposedFilename;
     DBFile = QDir::toNativeSeparators(DBFile);
-    bNewlyCreated = true;
+    bNewlyCreated = !CopyTemplateDatabase(DBFile);
   }
   qDebug() << "using DB: " << DBFile;
-  DataBase = QSqlDatabase::addDatabase("QSQLITE");
+  DataBase = QSqlDatabase::addDatabase("QSQLITE", m_ConnectionName);
   bool bSuccess = false;
   if (DataBase.isValid())
   {
@@ -73,6 +95,12 @@ bool DataBackend_pImpl::InitializeDB(const QString& ProposedFilename, QSqlDataba
       }
     }
   }
+  if (bSuccess && m_spPartitions->hasTables())
+  {
+    // attaches the current write partitions and deletes the expired ones
+    bSuccess = m_spPartitions->databaseOpened(DataBase);
+    qDebug() << "attaching partitions" << (bSuccess ? " ... ok" : " ... failed!");
+  }
   return bSuccess;
 }
 
@@ -129,6 +157,104 @@ bool DataBackend_pImpl::CreateTables(QSqlDatabase &DB)
   return bSuccess;
 }
 
+void DataBackend_pImpl::setTemplateDatabase(const QString& TemplateFilename)
+{
+  m_TemplateFilename = TemplateFilename;
+}
+
+QString DataBackend_pImpl::SchemaFingerprint() const
+{
+  QCryptographicHash Hash(QCryptographicHash::Sha1);
+  Hash.addData(QString::number(m_DBVersion).toUtf8());
+  for (auto It = m_Tables.cbegin(); It != m_Tables.cend(); It++)
+  {
+    const QStringList Statements = (*It)->getCreateStatements(m_DBVersion) + (*It)->insertInitialRows(m_DBVersion);
+    for (auto StatementIt = Statements.cbegin(); StatementIt != Statements.cend(); StatementIt++)
+    {
+      Hash.addData(StatementIt->toUtf8());
+      Hash.addData(QByteArray(1, '\0'));
+    }
+  }
+  return QString::fromLatin1(Hash.result().toHex());
+}
+
+bool DataBackend_pImpl::CreateTemplateDatabase(const QString& TemplateFilename)
+{
+  if (QFile::exists(TemplateFilename) && !QFile::remove(TemplateFilename))
+  {
+    qDebug() << "template database " << TemplateFilename << " can't be replaced";
+    return false;
+  }
+  bool bSuccess = false;
+  const QString ConnectionName = m_ConnectionName + "_template";
+  {
+    QSqlDatabase Template = QSqlDatabase::addDatabase("QSQLITE", ConnectionName);
+    Template.setDatabaseName(TemplateFilename);
+    // one transaction instead of one commit per statement, a failed template is discarded anyway
+    if (Template.open() && PrepareDatabaseForUse(Template) && CreateTablesInTransaction(Template))
+    {
+      QSqlQuery Query(Template);
+      bSuccess = Query.exec("CREATE TABLE dbtemplate ( fingerprint text );")
+        && Query.prepare("INSERT INTO dbtemplate ( fingerprint ) VALUES(?);");
+      if (bSuccess)
+      {
+        Query.addBindValue(SchemaFingerprint());
+        // VACUUM leaves a compact file without free pages
+        bSuccess = Query.exec() && Query.exec("VACUUM;");
+      }
+    }
+    Template.close();
+  }
+  QSqlDatabase::removeDatabase(ConnectionName);
+  qDebug() << "creating template database " << TemplateFilename << (bSuccess ? " ... ok" : " ... failed!");
+  return bSuccess;
+}
+
+bool DataBackend_pImpl::CreateTablesInTransaction(QSqlDatabase& DB)
+{
+  DbTransaction Transaction(DB);
+  return Transaction.isActive() && CreateTables(DB) && Transaction.commit();
+}
+
+bool DataBackend_pImpl::CopyTemplateDatabase(const QString& DbFilename)
+{
+  if (m_TemplateFilename.isEmpty())
+    return false;
+  if (!QFile::copy(m_TemplateFilename, DbFilename))
+  {
+    qDebug() << "template database " << m_TemplateFilename << " could not be copied";
+    return false;
+  }
+  // copies from Qt resources are read-only
+  QFile::setPermissions(DbFilename, QFile::ReadOwner | QFile::WriteOwner | QFile::ReadUser | QFile::WriteUser);
+
+  bool bValid = false;
+  const QString ConnectionName = m_ConnectionName + "_template";
+  {
+    QSqlDatabase Db = QSqlDatabase::addDatabase("QSQLITE", ConnectionName);
+    Db.setDatabaseName(DbFilename);
+    if (Db.open())
+    {
+      {
+        QSqlQuery Query(Db);
+        bValid = Query.exec("SELECT fingerprint FROM dbtemplate;") && Query.next()
+          && Query.value(0).toString() == SchemaFingerprint();
+        Query.finish();
+        // the marker table is no part of the schema
+        bValid = bValid && Query.exec("DROP TABLE dbtemplate;");
+      }
+      Db.close();
+    }
+  }
+  QSqlDatabase::removeDatabase(ConnectionName);
+  if (!bValid)
+  {
+    qDebug() << "template database " << m_TemplateFilename << " doesn't match the schema, creating tables instead";
+    QFile::remove(DbFilename);
+  }
+  return bValid;
+}
+
 bool DataBackend_pImpl::CheckDatabaseForUpdates(QSqlDatabase& DB)
 {
   bool bSuccess = false;
@@ -181,7 +307,8 @@ bool DataBackend_pImpl::PrepareDatabaseForUse(QSqlDatabase &DB)
   bool bSuccess = false;
   // we want to enable ForeignKeySupport
   QSqlQuery Query(DB);
-  if (Query.exec("PRAGMA foreign_keys = ON;"))
+  // REPLACE only runs the DELETE triggers of the replaced rows (FTS and aggregate tables) with recursive triggers
+  if (Query.exec("PRAGMA foreign_keys = ON;") && Query.exec("PRAGMA recursive_triggers = ON;"))
   {
     bSuccess = true;
   }
@@ -253,6 +380,12 @@ bool DataBackend_pImpl::DeleteAllData(QSqlDatabase &Db)
 			}
 		}
 	}
+	// partitioned tables lose their files, the next write creates them again
+	if (!m_spPartitions->dropAll(Db))
+	{
+		qDebug() << "Delete partitions ... failed !";
+		bDeleteOk = false;
+	}
 	return bDeleteOk;
 }
 
@@ -23,9 +23,16 @@ public:
   void setDbVersion(int CurrentVersion);
   void AddTable(std::unique_ptr<ITableDefinition> Table); // as we take ownership of the Table the returned unique_ptr will be empty
 	bool DeleteAllData(QSqlDatabase& DbToDelete);
+  bool AddPartitionedTable(const DbTimePartitionedTable& Table);
+  std::shared_ptr<DbPartitionManager> Partitions() const;
+  void setTemplateDatabase(const QString& TemplateFilename);
+  bool CreateTemplateDatabase(const QString& TemplateFilename);
+  QString SchemaFingerprint() const;
 
 private:
   bool CreateTables(QSqlDatabase& DB);
+  bool CreateTablesInTransaction(QSqlDatabase& DB); // for templates only, new files keep committing every statement
+  bool CopyTemplateDatabase(const QString& DbFilename); // copies and verifies the template, false if the tables have to be created
   bool CheckDatabaseForUpdates(QSqlDatabase& DB);
   bool RunUpdates(QSqlDatabase& DB, int OldVersion);
   bool PrepareDatabaseForUse(QSqlDatabase &DB);
@@ -33,7 +40,10 @@ private:
 
   // private member
   QString m_Filename;
+  QString m_ConnectionName; // unique per backend, several DbHandler may share a thread
+  QString m_TemplateFilename; // empty: no template database
   std::vector<std::shared_ptr<ITableDefinition> > m_Tables;
+  std::shared_ptr<DbPartitionManager> m_spPartitions; // never null, DbHandler hands it to readers and handlers
   int m_DBVersion; // this is the current version implemented in our  C++ code
 };
 